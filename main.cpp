@@ -28,6 +28,10 @@
 #include <GL/glut.h>
 
 #include "src/matrixUtilities.h"
+#include "src/CameraRayGenerator.h"
+#include "src/Renderer.h"
+#include "src/ImageWriter.h"
+#include "src/FileChunks.h"
 
 using namespace std;
 
@@ -55,17 +59,58 @@ unsigned int selected_scene;
 
 std::vector< std::pair< Vec3 , Vec3 > > rays;
 
+// Ray tracing settings
+static unsigned int renderThreads = 0; // 0 : one thread per core
+static unsigned int renderSeed = 0;
+static SamplingSettings renderSampling;
+static unsigned int lightSamples = 0; // 0 : the budget of each light
+static bool compressTextures = false;
+static ThreadPool * renderPool = NULL;
+static std::string outputFile = "./rendu.ppm";
+static float outputGamma = 1.f;
+static AsyncImageWriter * imageWriter = NULL;
+
+// Interactive ray tracing : the background render is shown instead of the GL preview
+static ProgressiveRender progressiveRender;
+static bool showRayTracedImage = false;
+static bool renderRestartNeeded = false;
+static GLuint renderTexture = 0;
+static float renderedSamples = 0.f;
+
+void ray_trace_from_camera ();
+
 void printUsage () {
 
 	cerr << endl
 		 << "gMini: a minimal OpenGL/GLUT application" << endl
 		 << "for 3D graphics." << endl
 		 << "Author : Tamy Boubekeur (http://www.labri.fr/~boubek)" << endl << endl
-		 << "Usage : ./gmini [<file.off>]" << endl
+		 << "Usage : ./gmini [-t <threads>] [-seed <seed>] [-spp <samples>] [-minspp <samples>] [-threshold <error>] [-sampler <type>] [-depth <n>] [-lightsamples <n>] [-nopackets] [-nowavefront] [-nobinning] [-nomipmaps] [-compresstextures] [-o <file>] [-gamma <g>] [<file.off>]" << endl
+		 << "        ./gmini -render <scene> [-size <w> <h>] [options] [<file.off>]" << endl
+		 << " <file.off>: polygon mesh, possibly gzip compressed, shown as scene 9 (a binary cache <file.off>.cache is kept next to it)" << endl
+		 << " -t <threads>: number of ray tracing threads (default: one per core)" << endl
+		 << " -seed <seed>: seed of the pixel jitter" << endl
+		 << " -spp <samples>: maximum samples per pixel (default: 128)" << endl
+		 << " -minspp <samples>: minimum samples per pixel (default: 8)" << endl
+		 << " -threshold <error>: relative noise level at which a pixel stops sampling, 0 to always take -spp samples (default: 0.02)" << endl
+		 << " -sampler <type>: random, sobol, halton or bluenoise (default: sobol)" << endl
+		 << " -depth <n>: maximum path length, in surface hits (default: 8)" << endl
+		 << " -lightsamples <n>: shadow rays per shading point for every area light (default: 4)" << endl
+		 << " -nopackets: trace every ray on its own instead of SIMD ray packets" << endl
+		 << " -nowavefront: trace every sample from the camera to the end of its path, instead of the samples of a tile stage by stage" << endl
+		 << " -nobinning: trace the secondary rays of the wavefront in queue order, without grouping them by origin and direction" << endl
+		 << " -nomipmaps: fetch textures at full resolution, whatever the footprint of the pixel" << endl
+		 << " -compresstextures: keep textures block compressed in memory (BC1, BC5 for normal maps)" << endl
+		 << " -render <scene>: render the scene offline, without a window, and exit" << endl
+		 << " -o <file>: rendered image, binary .ppm, float .pfm or half float .exr (default: ./rendu.ppm)" << endl
+		 << " -gamma <g>: gamma applied to 8 bit outputs (default: 1)" << endl
+		 << " -size <w> <h>: image size of -render (default: 480 480)" << endl << endl
 		 << "Keyboard commands" << endl
 		 << "------------------" << endl
 		 << " ?: Print help" << endl
 		 << " w: Toggle Wireframe Mode" << endl
+		 << " r: Toggle ray tracing of the current view (saved to the -o file when done)" << endl
+		 << " +: Next scene" << endl
 		 << " g: Toggle Gouraud Shading Mode" << endl
 		 << " f: Toggle full screen mode" << endl
 		 << " <drag>+<left button>: rotate model" << endl
@@ -119,6 +164,14 @@ void init () {
 
 void clear () {
 
+	progressiveRender.cancel ();
+	set_loader_pool (NULL);
+	delete renderPool;
+	renderPool = NULL;
+	// waits for the images still being written
+	delete imageWriter;
+	imageWriter = NULL;
+
 }
 
 // ------------------------------------
@@ -146,12 +199,60 @@ void draw () {
 
 }
 
+// Draws the latest pass of the background render over the whole window.
+void draw_ray_traced_image () {
+
+	static std::vector< Vec3 > image;
+	float samples = progressiveRender.fetch (image);
+	if (renderTexture == 0)
+		glGenTextures (1, &renderTexture);
+	glBindTexture (GL_TEXTURE_2D, renderTexture);
+	if (samples > 0.f) {
+		// image rows go from the top of the screen to the bottom
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+		// a SIMD Vec3 is padded to 4 floats : the 4th one is read as alpha and dropped
+		GLenum format = sizeof (Vec3) == 4 * sizeof (float) ? GL_RGBA : GL_RGB;
+		glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, progressiveRender.getWidth (), progressiveRender.getHeight (), 0, format, GL_FLOAT, (GLvoid*)image.data ());
+		renderedSamples = samples;
+	}
+	if (renderedSamples == 0.f)
+		return;
+
+	glMatrixMode (GL_PROJECTION);
+	glPushMatrix ();
+	glLoadIdentity ();
+	glMatrixMode (GL_MODELVIEW);
+	glPushMatrix ();
+	glLoadIdentity ();
+	glDisable (GL_LIGHTING);
+	glDisable (GL_DEPTH_TEST);
+	glEnable (GL_TEXTURE_2D);
+	glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glBegin (GL_QUADS);
+	glTexCoord2f (0.f, 1.f); glVertex2f (-1.f, -1.f);
+	glTexCoord2f (1.f, 1.f); glVertex2f (1.f, -1.f);
+	glTexCoord2f (1.f, 0.f); glVertex2f (1.f, 1.f);
+	glTexCoord2f (0.f, 0.f); glVertex2f (-1.f, 1.f);
+	glEnd ();
+	glDisable (GL_TEXTURE_2D);
+	glEnable (GL_DEPTH_TEST);
+	glPopMatrix ();
+	glMatrixMode (GL_PROJECTION);
+	glPopMatrix ();
+	glMatrixMode (GL_MODELVIEW);
+
+}
+
 void display () {
 
 	glLoadIdentity ();
 	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	camera.apply ();
 	draw ();
+	if (showRayTracedImage)
+		draw_ray_traced_image ();
 	glFlush ();
 	glutSwapBuffers ();
 
@@ -167,50 +268,45 @@ void idle () {
 		FPS = counter;
 		counter = 0;
 		static char winTitle [64];
-		sprintf (winTitle, "Raytracer - FPS: %d", FPS);
+		if (showRayTracedImage)
+			sprintf (winTitle, "Raytracer - FPS: %d - %.1f spp", FPS, renderedSamples);
+		else
+			sprintf (winTitle, "Raytracer - FPS: %d", FPS);
 		glutSetWindowTitle (winTitle);
 		lastTime = currentTime;
 	}
+	// the camera moved : the running render is outdated
+	if (showRayTracedImage && renderRestartNeeded)
+		ray_trace_from_camera ();
 	glutPostRedisplay ();
 
 }
 
 
+// Starts (or restarts) the background render of the current view.
+// The image is refined pass by pass in display (), and saved to outputFile once all samples are in.
 void ray_trace_from_camera() {
 
 	int w = glutGet(GLUT_WINDOW_WIDTH)  ,   h = glutGet(GLUT_WINDOW_HEIGHT);
-	std::cout << "Ray tracing a " << w << " x " << h << " image" << std::endl;
-	camera.apply();
-	Vec3 pos , dir;
-	//    unsigned int nsamples = 100;
-	unsigned int nsamples = 50;
-	std::vector< Vec3 > image( w*h , Vec3(0,0,0) );
-	for (int y=0; y<h; y++){
-		for (int x=0; x<w; x++) {
-			for( unsigned int s = 0 ; s < nsamples ; ++s ) {
-				float u = ((float)(x) + (float)(rand())/(float)(RAND_MAX)) / w;
-				float v = ((float)(y) + (float)(rand())/(float)(RAND_MAX)) / h;
-				// this is a random uv that belongs to the pixel xy.
-				screen_space_to_world_space_ray(u,v,pos,dir);
-				Vec3 color = scenes[selected_scene].rayTrace( Ray(pos , dir) );
-				image[x + y*w] += color;
-			}
-			image[x + y*w] /= nsamples;
-		}
-	}
-	std::cout << "\tDone" << std::endl;
+	CameraMatrices matrices;
+	get_camera_matrices( camera , matrices );
+	std::cout << "Ray tracing a " << w << " x " << h << " image on " << renderPool->size() << " thread(s)" << std::endl;
+	progressiveRender.start( *renderPool , scenes[selected_scene] , matrices , w , h , renderSeed , renderSampling , 1 ,
+		[]( std::vector< Vec3 > const & image , int w , int h , float averageSamples ) {
+			std::cout << "\tDone : " << averageSamples << " samples per pixel on average" << std::endl;
+			// encoded and written in the background : the next render can start right away
+			std::vector< Vec3 > copy( image );
+			imageWriter->write( outputFile , copy , w , h , outputGamma );
+		} );
+	renderRestartNeeded = false;
 
-	std::string filename = "./rendu.ppm";
-	ofstream f(filename.c_str(), ios::binary);
-	if (f.fail()) {
-		cout << "Could not open file: " << filename << endl;
-		return;
-	}
-	f << "P3" << std::endl << w << " " << h << std::endl << 255 << std::endl;
-	for (int i=0; i<w*h; i++)
-		f << (int)(255.f*std::min<float>(1.f,image[i][0])) << " " << (int)(255.f*std::min<float>(1.f,image[i][1])) << " " << (int)(255.f*std::min<float>(1.f,image[i][2])) << " ";
-	f << std::endl;
-	f.close();
+}
+
+void stop_ray_trace() {
+
+	progressiveRender.cancel();
+	showRayTracedImage = false;
+	renderedSamples = 0.f;
 
 }
 
@@ -244,13 +340,19 @@ void key (unsigned char keyPressed, int x, int y) {
 		break;
 
 	case 'r':
-		camera.apply();
 		rays.clear();
-		ray_trace_from_camera();
+		if (showRayTracedImage) {
+			stop_ray_trace();
+		} else {
+			showRayTracedImage = true;
+			ray_trace_from_camera();
+		}
 		break;
 	case '+':
+		progressiveRender.cancel();
 		selected_scene++;
 		if( selected_scene >= scenes.size() ) selected_scene = 0;
+		renderRestartNeeded = true;
 		break;
 	default:
 		printUsage ();
@@ -297,15 +399,18 @@ void motion (int x, int y) {
 
 	if (mouseRotatePressed == true) {
 		camera.rotate (x, y);
+		renderRestartNeeded = true;
 	}
 	else if (mouseMovePressed == true) {
 		camera.move ((x-lastX)/static_cast<float>(SCREENWIDTH), (lastY-y)/static_cast<float>(SCREENHEIGHT), 0.0);
 		lastX = x;
 		lastY = y;
+		renderRestartNeeded = true;
 	}
 	else if (mouseZoomPressed == true) {
 		camera.zoom (float (y-lastZoom)/SCREENHEIGHT);
 		lastZoom = y;
+		renderRestartNeeded = true;
 	}
 
 }
@@ -313,32 +418,14 @@ void motion (int x, int y) {
 void reshape(int w, int h) {
 
 	camera.resize (w, h);
+	renderRestartNeeded = true;
 
 }
 
-int main (int argc, char ** argv) {
-
-	if (argc > 2) {
-		printUsage ();
-		exit (EXIT_FAILURE);
-	}
-	glutInit (&argc, argv);
-	glutInitDisplayMode (GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE);
-	glutInitWindowSize (SCREENWIDTH, SCREENHEIGHT);
-	window = glutCreateWindow ("gMini");
-
-	init ();
-	glutIdleFunc (idle);
-	glutDisplayFunc (display);
-	glutKeyboardFunc (key);
-	glutReshapeFunc (reshape);
-	glutMotionFunc (motion);
-	glutMouseFunc (mouse);
-	key ('?', 0, 0);
+void setup_scenes (std::string const & meshFile) {
 
-	camera.move(0., 0., -3.1);
 	selected_scene=0;
-	scenes.resize(7);
+	scenes.resize(meshFile.empty() ? 9 : 10);
 
 	// Default Scene 0
 	scenes[0].setup_single_sphere(Vec3(1.f, 1.f, 1.f));
@@ -359,6 +446,124 @@ int main (int argc, char ** argv) {
 	scenes[1].setup_single_square();
 	scenes[2].setup_cornell_box();
 
+	// Thousands of lights
+	scenes[7].setup_many_lights();
+
+	// Textures
+	scenes[8].setup_textured();
+
+	// OFF file given on the command line
+	if (!meshFile.empty() && !scenes[9].setup_single_mesh(meshFile))
+		scenes.resize(9);
+
+	if (lightSamples > 0)
+		for (unsigned int i = 0; i < scenes.size(); i++)
+			scenes[i].setLightSamples(lightSamples);
+
+	if (compressTextures)
+		for (unsigned int i = 0; i < scenes.size(); i++)
+			scenes[i].compressTextures();
+
+}
+
+// Offline rendering : the camera matrices are built on the CPU, GLUT is never initialized.
+int render_offline (unsigned int scene, std::string const & filename, int w, int h) {
+
+	if (scene >= scenes.size()) {
+		cerr << "No scene " << scene << " (" << scenes.size() << " scenes)" << endl;
+		return EXIT_FAILURE;
+	}
+	camera.setScreenSize (w, h);
+	CameraMatrices matrices;
+	get_camera_matrices (camera, matrices);
+	std::vector< Vec3 > image;
+	render_image (*renderPool, scenes[scene], matrices, w, h, renderSeed, renderSampling, image);
+	return write_image (filename, image, w, h, image_format_from_filename (filename), outputGamma) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+}
+
+int main (int argc, char ** argv) {
+
+	int nPositional = 0;
+	std::string meshFile;
+	int offlineScene = -1;
+	int offlineW = SCREENWIDTH, offlineH = SCREENHEIGHT;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc)
+			renderThreads = atoi (argv[++i]);
+		else if (arg == "-seed" && i + 1 < argc)
+			renderSeed = strtoul (argv[++i], NULL, 10);
+		else if (arg == "-spp" && i + 1 < argc)
+			renderSampling.maxSamples = std::max (1, atoi (argv[++i]));
+		else if (arg == "-minspp" && i + 1 < argc)
+			renderSampling.minSamples = std::max (1, atoi (argv[++i]));
+		else if (arg == "-threshold" && i + 1 < argc)
+			renderSampling.threshold = atof (argv[++i]);
+		else if (arg == "-sampler" && i + 1 < argc) {
+			if (!parse_sampler_type (argv[++i], renderSampling.sampler))
+				usage ();
+		}
+		else if (arg == "-depth" && i + 1 < argc)
+			renderSampling.maxDepth = std::max (1, atoi (argv[++i]));
+		else if (arg == "-lightsamples" && i + 1 < argc)
+			lightSamples = std::max (1, atoi (argv[++i]));
+		else if (arg == "-nopackets")
+			renderSampling.packets = false;
+		else if (arg == "-nowavefront")
+			renderSampling.wavefront = false;
+		else if (arg == "-nobinning")
+			renderSampling.binning = false;
+		else if (arg == "-nomipmaps")
+			renderSampling.mipmaps = false;
+		else if (arg == "-compresstextures")
+			compressTextures = true;
+		else if (arg == "-render" && i + 1 < argc)
+			offlineScene = atoi (argv[++i]);
+		else if (arg == "-o" && i + 1 < argc)
+			outputFile = argv[++i];
+		else if (arg == "-gamma" && i + 1 < argc)
+			outputGamma = atof (argv[++i]);
+		else if (arg == "-size" && i + 2 < argc) {
+			offlineW = atoi (argv[++i]);
+			offlineH = atoi (argv[++i]);
+			if (offlineW < 1 || offlineH < 1)
+				usage ();
+		}
+		else if (arg[0] == '-' || ++nPositional > 1)
+			usage ();
+		else
+			meshFile = arg;
+	}
+	if (outputGamma <= 0.f)
+		usage ();
+	renderPool = new ThreadPool (renderThreads);
+	set_loader_pool (renderPool);
+	imageWriter = new AsyncImageWriter ();
+
+	camera.move(0., 0., -3.1);
+	setup_scenes (meshFile);
+
+	if (offlineScene >= 0) {
+		int status = render_offline (offlineScene, outputFile, offlineW, offlineH);
+		clear ();
+		return status;
+	}
+
+	glutInit (&argc, argv);
+	glutInitDisplayMode (GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE);
+	glutInitWindowSize (SCREENWIDTH, SCREENHEIGHT);
+	window = glutCreateWindow ("gMini");
+
+	init ();
+	glutIdleFunc (idle);
+	glutDisplayFunc (display);
+	glutKeyboardFunc (key);
+	glutReshapeFunc (reshape);
+	glutMotionFunc (motion);
+	glutMouseFunc (mouse);
+	key ('?', 0, 0);
+
 	glutMainLoop ();
 	return EXIT_SUCCESS;
 
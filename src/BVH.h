@@ -0,0 +1,367 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include "Vec3.h"
+#include "Ray.h"
+#include "RayPacket.h"
+
+// -------------------------------------------
+// Bounding volume hierarchy over primitives of any type.
+// A primitive is a (type, index) pair and its bounding box: the BVH does not know what it
+// bounds, the traversal hands every primitive of the leaves it reaches to a callback.
+// Built with the surface area heuristic over binned centroids.
+// -------------------------------------------
+
+struct AABB {
+    float bmin[3] , bmax[3];
+
+    AABB() {
+        bmin[0] = bmin[1] = bmin[2] = FLT_MAX;
+        bmax[0] = bmax[1] = bmax[2] = -FLT_MAX;
+    }
+    void extend( Vec3 const & p ) {
+        for( int c = 0 ; c < 3 ; ++c ) {
+            bmin[c] = std::min( bmin[c] , p[c] );
+            bmax[c] = std::max( bmax[c] , p[c] );
+        }
+    }
+    void extend( AABB const & box ) {
+        for( int c = 0 ; c < 3 ; ++c ) {
+            bmin[c] = std::min( bmin[c] , box.bmin[c] );
+            bmax[c] = std::max( bmax[c] , box.bmax[c] );
+        }
+    }
+    bool empty() const { return bmin[0] > bmax[0]; }
+    Vec3 center() const { return Vec3( 0.5f * ( bmin[0] + bmax[0] ) , 0.5f * ( bmin[1] + bmax[1] ) , 0.5f * ( bmin[2] + bmax[2] ) ); }
+    float area() const {
+        if( empty() ) return 0.f;
+        float dx = bmax[0] - bmin[0] , dy = bmax[1] - bmin[1] , dz = bmax[2] - bmin[2];
+        return 2.f * ( dx * dy + dy * dz + dz * dx );
+    }
+
+    // slab test against [0,tMax], tNear is the entry distance
+    bool intersect( Vec3 const & origin , float const invDirection[3] , float tMax , float & tNear ) const {
+        float t0 = 0.f , t1 = tMax;
+        for( int c = 0 ; c < 3 ; ++c ) {
+            float tA = ( bmin[c] - origin[c] ) * invDirection[c];
+            float tB = ( bmax[c] - origin[c] ) * invDirection[c];
+            if( tA > tB ) std::swap( tA , tB );
+            t0 = tA > t0 ? tA : t0;
+            t1 = tB < t1 ? tB : t1;
+            if( t0 > t1 ) return false;
+        }
+        tNear = t0;
+        return true;
+    }
+};
+
+struct BVHPrimitive {
+    AABB bounds;
+    unsigned int type , index;
+
+    BVHPrimitive() : type( 0 ) , index( 0 ) {}
+    BVHPrimitive( AABB const & b , unsigned int t , unsigned int i ) : bounds( b ) , type( t ) , index( i ) {}
+};
+
+// 32 bytes. Inner node : its left child follows it, offset is the right child.
+// Leaf : count > 0 primitives starting at offset.
+struct BVHNode {
+    AABB bounds;
+    uint32_t offset;
+    uint16_t count;
+    uint16_t axis;
+
+    bool isLeaf() const { return count > 0; }
+};
+
+class BVH {
+public:
+    BVH() {}
+
+    void clear() {
+        nodes.clear();
+        primitives.clear();
+    }
+    bool empty() const { return nodes.empty(); }
+    unsigned int nodeCount() const { return nodes.size(); }
+    AABB bounds() const { return nodes.empty() ? AABB() : nodes[0].bounds; }
+
+    void build( std::vector< BVHPrimitive > const & prims ) {
+        clear();
+        if( prims.empty() ) return;
+        primitives = prims;
+        std::vector< Vec3 > centroids( primitives.size() );
+        for( unsigned int i = 0 ; i < primitives.size() ; ++i )
+            centroids[i] = primitives[i].bounds.center();
+        nodes.reserve( 2 * primitives.size() );
+        buildRecursive( 0 , primitives.size() , centroids , 0 );
+    }
+
+    // Closest hit traversal : nodes are visited front to back and pruned against tMax.
+    // intersectPrimitive( type , index , tMax ) tests one primitive and lowers tMax on a closer hit.
+    template< class PrimitiveIntersector >
+    void traverse( Ray const & ray , float & tMax , PrimitiveIntersector const & intersectPrimitive ) const {
+        if( nodes.empty() ) return;
+        Vec3 const & origin = ray.origin();
+        Vec3 const & direction = ray.direction();
+        float invDirection[3] = { 1.f / direction[0] , 1.f / direction[1] , 1.f / direction[2] };
+        float tNear;
+        if( !nodes[0].bounds.intersect( origin , invDirection , tMax , tNear ) ) return;
+
+        unsigned int stack[STACK_SIZE];
+        unsigned int stackSize = 0;
+        unsigned int current = 0;
+        while( true ) {
+            BVHNode const & node = nodes[current];
+            if( node.isLeaf() ) {
+                for( unsigned int i = node.offset ; i < node.offset + node.count ; ++i )
+                    intersectPrimitive( primitives[i].type , primitives[i].index , tMax );
+            } else {
+                unsigned int left = current + 1 , right = node.offset;
+                float tLeft , tRight;
+                bool hitLeft = nodes[left].bounds.intersect( origin , invDirection , tMax , tLeft );
+                bool hitRight = nodes[right].bounds.intersect( origin , invDirection , tMax , tRight );
+                if( hitLeft && hitRight ) {
+                    if( tRight < tLeft ) std::swap( left , right );
+                    stack[stackSize++] = right;
+                    current = left;
+                    continue;
+                }
+                if( hitLeft ) { current = left; continue; }
+                if( hitRight ) { current = right; continue; }
+            }
+            // the stack only holds nodes that were hit : skip those behind the closest hit found since
+            bool found = false;
+            while( stackSize > 0 && !found ) {
+                current = stack[--stackSize];
+                found = nodes[current].bounds.intersect( origin , invDirection , tMax , tNear );
+            }
+            if( !found ) return;
+        }
+    }
+
+    // Any hit traversal for occlusion queries : no ordering, stops as soon as
+    // hitsPrimitive( type , index ) returns true for a primitive of a box hit before tMax.
+    template< class PrimitiveTest >
+    bool traverseAny( Ray const & ray , float tMax , PrimitiveTest const & hitsPrimitive ) const {
+        if( nodes.empty() ) return false;
+        Vec3 const & origin = ray.origin();
+        Vec3 const & direction = ray.direction();
+        float invDirection[3] = { 1.f / direction[0] , 1.f / direction[1] , 1.f / direction[2] };
+        float tNear;
+
+        unsigned int stack[STACK_SIZE];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        while( stackSize > 0 ) {
+            unsigned int current = stack[--stackSize];
+            BVHNode const & node = nodes[current];
+            if( !node.bounds.intersect( origin , invDirection , tMax , tNear ) ) continue;
+            if( node.isLeaf() ) {
+                for( unsigned int i = node.offset ; i < node.offset + node.count ; ++i )
+                    if( hitsPrimitive( primitives[i].type , primitives[i].index ) ) return true;
+            } else {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = current + 1;
+            }
+        }
+        return false;
+    }
+
+    // Packet traversal : a node is entered if one active lane hits its box before its closest hit.
+    // Children are visited in the order of the packet's first ray along the split axis.
+    // intersectPrimitive( type , index ) tests the primitive against the whole packet.
+    // With anyHit, the traversal stops once every ray has a hit (type >= 0).
+    template< class PrimitiveIntersector >
+    void traversePacket( RayPacket & packet , PrimitiveIntersector const & intersectPrimitive , bool anyHit = false ) const {
+        if( nodes.empty() ) return;
+        float invDirection[3][RAY_PACKET_SIZE] __attribute__(( aligned( 32 ) ));
+        for( unsigned int i = 0 ; i < packet.paddedSize() ; ++i ) {
+            invDirection[0][i] = 1.f / packet.dx[i];
+            invDirection[1][i] = 1.f / packet.dy[i];
+            invDirection[2][i] = 1.f / packet.dz[i];
+        }
+        float firstDirection[3] = { packet.dx[0] , packet.dy[0] , packet.dz[0] };
+
+        unsigned int stack[STACK_SIZE];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        while( stackSize > 0 ) {
+            BVHNode const & node = nodes[stack[--stackSize]];
+            if( !packetHitsBox( packet , invDirection , node.bounds ) ) continue;
+            if( node.isLeaf() ) {
+                for( unsigned int i = node.offset ; i < node.offset + node.count ; ++i )
+                    intersectPrimitive( primitives[i].type , primitives[i].index );
+                if( anyHit && packet.allHit() ) return;
+            } else {
+                unsigned int left = &node - &nodes[0] + 1 , right = node.offset;
+                // the near child is pushed last so that it is popped first
+                if( firstDirection[node.axis] < 0.f ) std::swap( left , right );
+                stack[stackSize++] = right;
+                stack[stackSize++] = left;
+            }
+        }
+    }
+
+    // Traversal stacks hold at most one node per level, plus one : the build keeps the depth below STACK_SIZE
+    static const unsigned int STACK_SIZE = 64;
+
+private:
+    static const unsigned int SAH_BINS = 12;
+    static const unsigned int MAX_LEAF_SIZE = 4;
+    // From this depth on, nodes are split at the median centroid instead of the SAH split : skewed centroids
+    // (exponentially spaced primitives, say) can make the SAH cut one primitive at a time, while halving at most 2^32
+    // primitives takes 32 more levels
+    static const unsigned int MAX_SAH_DEPTH = STACK_SIZE - 1 - 32;
+
+    unsigned int buildRecursive( unsigned int begin , unsigned int end , std::vector< Vec3 > & centroids , unsigned int depth ) {
+        unsigned int nodeIndex = nodes.size();
+        nodes.push_back( BVHNode() );
+        AABB bounds , centroidBounds;
+        for( unsigned int i = begin ; i < end ; ++i ) {
+            bounds.extend( primitives[i].bounds );
+            centroidBounds.extend( centroids[i] );
+        }
+        nodes[nodeIndex].bounds = bounds;
+        unsigned int count = end - begin;
+
+        // split axis : largest extent of the centroids
+        int axis = 0;
+        float extent = -1.f;
+        for( int c = 0 ; c < 3 ; ++c ) {
+            if( centroidBounds.bmax[c] - centroidBounds.bmin[c] > extent ) {
+                extent = centroidBounds.bmax[c] - centroidBounds.bmin[c];
+                axis = c;
+            }
+        }
+        if( count == 1 || extent <= 0.f ) {
+            makeLeaf( nodeIndex , begin , count , centroids , depth );
+            return nodeIndex;
+        }
+        if( depth >= MAX_SAH_DEPTH ) {
+            if( count <= MAX_LEAF_SIZE ) {
+                makeLeaf( nodeIndex , begin , count , centroids , depth );
+                return nodeIndex;
+            }
+            unsigned int middle = begin + count / 2;
+            partitionAtMedian( begin , middle , end , axis , centroids );
+            split( nodeIndex , begin , middle , end , axis , centroids , depth );
+            return nodeIndex;
+        }
+
+        // binned SAH : cost of a split is area(left) * n(left) + area(right) * n(right)
+        AABB binBounds[SAH_BINS];
+        unsigned int binCount[SAH_BINS] = { 0 };
+        float binScale = SAH_BINS / extent , binStart = centroidBounds.bmin[axis];
+        for( unsigned int i = begin ; i < end ; ++i ) {
+            unsigned int b = std::min( SAH_BINS - 1 , (unsigned int)( ( centroids[i][axis] - binStart ) * binScale ) );
+            binBounds[b].extend( primitives[i].bounds );
+            ++binCount[b];
+        }
+        float rightArea[SAH_BINS];
+        unsigned int rightCount[SAH_BINS];
+        AABB accumulated;
+        unsigned int accumulatedCount = 0;
+        for( int b = SAH_BINS - 1 ; b > 0 ; --b ) {
+            accumulated.extend( binBounds[b] );
+            accumulatedCount += binCount[b];
+            rightArea[b] = accumulated.area();
+            rightCount[b] = accumulatedCount;
+        }
+        float bestCost = FLT_MAX;
+        unsigned int bestSplit = 1;
+        accumulated = AABB();
+        accumulatedCount = 0;
+        for( unsigned int b = 1 ; b < SAH_BINS ; ++b ) {
+            accumulated.extend( binBounds[b - 1] );
+            accumulatedCount += binCount[b - 1];
+            float cost = accumulated.area() * accumulatedCount + rightArea[b] * rightCount[b];
+            if( cost < bestCost ) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+        // a leaf costs one intersection per primitive, a split one box test and its children
+        float leafCost = bounds.area() * count;
+        if( count <= MAX_LEAF_SIZE && leafCost <= bestCost + bounds.area() ) {
+            makeLeaf( nodeIndex , begin , count , centroids , depth );
+            return nodeIndex;
+        }
+
+        unsigned int middle = begin;
+        for( unsigned int i = begin ; i < end ; ++i ) {
+            unsigned int b = std::min( SAH_BINS - 1 , (unsigned int)( ( centroids[i][axis] - binStart ) * binScale ) );
+            if( b < bestSplit ) {
+                std::swap( primitives[i] , primitives[middle] );
+                std::swap( centroids[i] , centroids[middle] );
+                ++middle;
+            }
+        }
+        if( middle == begin || middle == end ) middle = begin + count / 2;
+
+        split( nodeIndex , begin , middle , end , axis , centroids , depth );
+        return nodeIndex;
+    }
+
+    void split( unsigned int nodeIndex , unsigned int begin , unsigned int middle , unsigned int end , int axis , std::vector< Vec3 > & centroids , unsigned int depth ) {
+        nodes[nodeIndex].axis = axis;
+        nodes[nodeIndex].count = 0;
+        buildRecursive( begin , middle , centroids , depth + 1 );
+        unsigned int right = buildRecursive( middle , end , centroids , depth + 1 );
+        nodes[nodeIndex].offset = right;
+    }
+
+    // Reorders [begin,end) so that the centroids of [begin,middle) are not after those of [middle,end) along axis
+    void partitionAtMedian( unsigned int begin , unsigned int middle , unsigned int end , int axis , std::vector< Vec3 > & centroids ) {
+        std::vector< unsigned int > order( end - begin );
+        for( unsigned int i = 0 ; i < order.size() ; ++i )
+            order[i] = begin + i;
+        std::nth_element( order.begin() , order.begin() + ( middle - begin ) , order.end() ,
+                          [&]( unsigned int a , unsigned int b ) { return centroids[a][axis] < centroids[b][axis]; } );
+        std::vector< BVHPrimitive > sortedPrimitives( order.size() );
+        std::vector< Vec3 > sortedCentroids( order.size() );
+        for( unsigned int i = 0 ; i < order.size() ; ++i ) {
+            sortedPrimitives[i] = primitives[order[i]];
+            sortedCentroids[i] = centroids[order[i]];
+        }
+        std::copy( sortedPrimitives.begin() , sortedPrimitives.end() , primitives.begin() + begin );
+        std::copy( sortedCentroids.begin() , sortedCentroids.end() , centroids.begin() + begin );
+    }
+
+    void makeLeaf( unsigned int nodeIndex , unsigned int begin , unsigned int count , std::vector< Vec3 > & centroids , unsigned int depth ) {
+        // leaves are small in practice; big ones (identical centroids) are split in halves
+        if( count > 0xffff ) {
+            split( nodeIndex , begin , begin + count / 2 , begin + count , 0 , centroids , depth );
+            return;
+        }
+        nodes[nodeIndex].offset = begin;
+        nodes[nodeIndex].count = count;
+        nodes[nodeIndex].axis = 0;
+    }
+
+    static bool packetHitsBox( RayPacket const & packet , float const invDirection[3][RAY_PACKET_SIZE] , AABB const & box ) {
+        using namespace simd;
+        vfloat minX = set1( box.bmin[0] ) , minY = set1( box.bmin[1] ) , minZ = set1( box.bmin[2] );
+        vfloat maxX = set1( box.bmax[0] ) , maxY = set1( box.bmax[1] ) , maxZ = set1( box.bmax[2] );
+        for( unsigned int i = 0 ; i < packet.paddedSize() ; i += SIMD_WIDTH ) {
+            vfloat ox = load( packet.ox + i ) , oy = load( packet.oy + i ) , oz = load( packet.oz + i );
+            vfloat ix = load( invDirection[0] + i ) , iy = load( invDirection[1] + i ) , iz = load( invDirection[2] + i );
+            vfloat ax = mul( sub( minX , ox ) , ix ) , bx = mul( sub( maxX , ox ) , ix );
+            vfloat ay = mul( sub( minY , oy ) , iy ) , by = mul( sub( maxY , oy ) , iy );
+            vfloat az = mul( sub( minZ , oz ) , iz ) , bz = mul( sub( maxZ , oz ) , iz );
+            vfloat t0 = max( max( min( ax , bx ) , min( ay , by ) ) , max( min( az , bz ) , set1( 0.f ) ) );
+            vfloat t1 = min( min( max( ax , bx ) , max( ay , by ) ) , min( max( az , bz ) , load( packet.t + i ) ) );
+            if( movemask( le( t0 , t1 ) ) != 0 ) return true;
+        }
+        return false;
+    }
+
+    std::vector< BVHNode > nodes;
+    std::vector< BVHPrimitive > primitives;
+};
+
+#endif // BVH_H
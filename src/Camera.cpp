@@ -11,6 +11,7 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <iostream>
+#include <cmath>
 
 using namespace std;
 
@@ -41,18 +42,26 @@ Camera::Camera () {
 
 void Camera::resize (int _W, int _H) {
 	
-	H = _H;
-	W = _W;
+	setScreenSize (_W, _H);
 	glViewport (0, 0, (GLint)W, (GLint)H);
 	glMatrixMode (GL_PROJECTION);
-	glLoadIdentity ();
-	aspectRatio = static_cast<float>(W)/static_cast<float>(H);
-	gluPerspective (fovAngle, aspectRatio, nearPlane, farPlane);
+	GLdouble projection[16];
+	getProjectionMatrix (projection);
+	glLoadMatrixd (projection);
 	glMatrixMode (GL_MODELVIEW);
 
 }
 
 
+void Camera::setScreenSize (int _W, int _H) {
+
+	H = _H;
+	W = _W;
+	aspectRatio = static_cast<float>(W)/static_cast<float>(H);
+
+}
+
+
 void Camera::initPos () {
 
 	if (!ini) {
@@ -139,12 +148,39 @@ void Camera::zoom (float z) {
 
 void Camera::apply () {
 
-	glLoadIdentity();
-	glTranslatef (x, y, z);
-	GLfloat m[4][4]; 
-	build_rotmatrix(m, curquat);
-	glTranslatef (0.0, 0.0, -_zoom);
-	glMultMatrixf(&m[0][0]);
+	GLdouble modelview[16];
+	getModelViewMatrix (modelview);
+	glLoadMatrixd (modelview);
+
+}
+
+
+void Camera::getModelViewMatrix (double m[16]) const {
+
+	// same as glTranslatef (x, y, z); glTranslatef (0.0, 0.0, -_zoom); glMultMatrixf (rotation);
+	float rotation[4][4];
+	float q[4] = {curquat[0], curquat[1], curquat[2], curquat[3]};
+	build_rotmatrix(rotation, q);
+	for (int i = 0; i < 16; i++)
+		m[i] = (&rotation[0][0])[i];
+	m[12] = x;
+	m[13] = y;
+	m[14] = z - _zoom;
+
+}
+
+
+void Camera::getProjectionMatrix (double m[16]) const {
+
+	// same as gluPerspective (fovAngle, aspectRatio, nearPlane, farPlane);
+	double f = 1.0 / tan (fovAngle * M_PI / 360.0);
+	for (int i = 0; i < 16; i++)
+		m[i] = 0.0;
+	m[0] = f / aspectRatio;
+	m[5] = f;
+	m[10] = (farPlane + nearPlane) / (nearPlane - farPlane);
+	m[11] = -1.0;
+	m[14] = 2.0 * farPlane * nearPlane / (nearPlane - farPlane);
 
 }
 
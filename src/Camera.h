@@ -28,6 +28,7 @@ public:
   inline unsigned int getScreenHeight () const { return H; }
   
   void resize (int W, int H);
+  void setScreenSize (int W, int H);
   
   void initPos ();
 
@@ -37,6 +38,11 @@ public:
   void endRotate ();
   void zoom (float z);
   void apply ();
+
+  // Column-major matrices, as glLoadMatrixd expects them.
+  // They are built on the CPU, so they can be used without a GL context.
+  void getModelViewMatrix (double m[16]) const;
+  void getProjectionMatrix (double m[16]) const;
   
   void getPos (float & x, float & y, float & z);
   inline void getPos (Vec3 & p) { getPos (p[0], p[1], p[2]); }
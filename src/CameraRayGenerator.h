@@ -0,0 +1,83 @@
+#ifndef CAMERARAYGENERATOR_H
+#define CAMERARAYGENERATOR_H
+
+#include <cmath>
+#include "Vec3.h"
+#include "matrixUtilities.h"
+
+// -------------------------------------------
+// Primary ray generator.
+// The camera matrices are inverted once per frame. The origin is the same for
+// every primary ray. For a pinhole camera, the (unnormalized) direction through
+// the screen point (u,v) is affine in u and v:
+//     d(u,v) = d00 + u * dU + v * dV
+// so a ray costs a few multiply-adds and one normalization.
+// -------------------------------------------
+
+class CameraRayGenerator {
+public:
+    CameraRayGenerator() {}
+    CameraRayGenerator( CameraMatrices const & matrices ) { setup( matrices ); }
+
+    void setup( CameraMatrices const & matrices ) {
+        GLdouble projectionInverse[16] , modelviewInverse[16];
+        gluInvertMatrix( matrices.projection , projectionInverse );
+        gluInvertMatrix( matrices.modelview , modelviewInverse );
+
+        GLdouble o[4];
+        mult( modelviewInverse , 0.0 , 0.0 , 0.0 , 1.0 , o[0] , o[1] , o[2] , o[3] );
+        m_origin = Vec3( o[0] / o[3] , o[1] / o[3] , o[2] / o[3] );
+
+        // same convention as screen_space_to_worldSpace : (0,0) is the top left corner of the screen
+        GLdouble p00[3] , p10[3] , p01[3];
+        unproject( projectionInverse , modelviewInverse , matrices.depthRange[0] , 0.0 , 0.0 , p00 );
+        unproject( projectionInverse , modelviewInverse , matrices.depthRange[0] , 1.0 , 0.0 , p10 );
+        unproject( projectionInverse , modelviewInverse , matrices.depthRange[0] , 0.0 , 1.0 , p01 );
+        m_d00 = Vec3( p00[0] - o[0] / o[3] , p00[1] - o[1] / o[3] , p00[2] - o[2] / o[3] );
+        m_dU = Vec3( p10[0] - p00[0] , p10[1] - p00[1] , p10[2] - p00[2] );
+        m_dV = Vec3( p01[0] - p00[0] , p01[1] - p00[1] , p01[2] - p00[2] );
+    }
+
+    Vec3 const & origin() const { return m_origin; }
+
+    // Angle between the rays of two neighbouring pixels at the center of a screen h pixels high (square pixels) :
+    // the spread of the ray cone of a camera ray
+    float pixelSpread( int h ) const {
+        Vec3 center( m_d00[0] + 0.5f * ( m_dU[0] + m_dV[0] ) , m_d00[1] + 0.5f * ( m_dU[1] + m_dV[1] ) , m_d00[2] + 0.5f * ( m_dU[2] + m_dV[2] ) );
+        return m_dV.length() / ( h * center.length() );
+    }
+
+    // u and v are in [0,1], (0,0) is the top left corner of the screen
+    Vec3 direction( float u , float v ) const {
+        return normalized( m_d00[0] + u * m_dU[0] + v * m_dV[0] ,
+                           m_d00[1] + u * m_dU[1] + v * m_dV[1] ,
+                           m_d00[2] + u * m_dU[2] + v * m_dV[2] );
+    }
+
+    // n rays at arbitrary screen positions
+    void generate( float const * u , float const * v , unsigned int n , Vec3 * directions ) const {
+        for( unsigned int i = 0 ; i < n ; ++i )
+            directions[i] = direction( u[i] , v[i] );
+    }
+
+private:
+    static void unproject( GLdouble const projectionInverse[16] , GLdouble const modelviewInverse[16] , GLdouble depth , GLdouble u , GLdouble v , GLdouble res[3] ) {
+        GLdouble resInt[4] , resWorld[4];
+        mult( projectionInverse , 2.0 * u - 1.0 , -( 2.0 * v - 1.0 ) , depth , 1.0 , resInt[0] , resInt[1] , resInt[2] , resInt[3] );
+        mult( modelviewInverse , resInt[0] , resInt[1] , resInt[2] , resInt[3] , resWorld[0] , resWorld[1] , resWorld[2] , resWorld[3] );
+        res[0] = resWorld[0] / resWorld[3];
+        res[1] = resWorld[1] / resWorld[3];
+        res[2] = resWorld[2] / resWorld[3];
+    }
+
+    static Vec3 normalized( float x , float y , float z ) {
+        Vec3 d( x , y , z );
+        d.normalize();
+        return d;
+    }
+
+    Vec3 m_origin;
+    Vec3 m_d00 , m_dU , m_dV;
+};
+
+#endif // CAMERARAYGENERATOR_H
@@ -0,0 +1,165 @@
+#include "FileChunks.h"
+#include "ThreadPool.h"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+FileBytes::FileBytes() : data( NULL ) , bytes( 0 ) , mapping( NULL ) {}
+
+FileBytes::~FileBytes() {
+    if( mapping != NULL )
+        munmap( mapping , bytes );
+}
+
+bool FileBytes::open( std::string const & name ) {
+    int fd = ::open( name.c_str() , O_RDONLY );
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    if( fstat( fd , &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+        void * p = mmap( NULL , st.st_size , PROT_READ , MAP_PRIVATE , fd , 0 );
+        if( p != MAP_FAILED ) {
+            madvise( p , st.st_size , MADV_SEQUENTIAL );
+            mapping = p;
+            data = (const char *)p;
+            bytes = st.st_size;
+        }
+    }
+    ::close( fd );
+    if( mapping == NULL ) {
+        std::ifstream in( name.c_str() , std::ios::binary );
+        buffer.assign( std::istreambuf_iterator< char >( in ) , std::istreambuf_iterator< char >() );
+        if( in.bad() )
+            return false;
+        data = buffer.data();
+        bytes = buffer.size();
+    }
+    return true;
+}
+
+bool FileBytes::isGzip() const {
+    return bytes >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+}
+
+void * FileBytes::release() {
+    void * p = mapping;
+    mapping = NULL;
+    return p;
+}
+
+
+GzipLines::GzipLines( const char * begin , const char * end , size_t blockBytes ) : input( begin ) , inputBytes( end - begin ) ,
+    consumed( 0 ) , blockBytes( blockBytes ) , produced( 0 ) , returned( 0 ) , stream( NULL ) , finished( false ) , error( false ) {}
+
+GzipLines::~GzipLines() {
+    if( stream != NULL ) {
+        inflateEnd( (z_stream *)stream );
+        delete (z_stream *)stream;
+    }
+}
+
+void GzipLines::fill() {
+    z_stream * z = (z_stream *)stream;
+    while( !finished && !error && produced < buffer.size() ) {
+        // avail_in and avail_out are 32 bits : feed at most 1 GB at a time
+        z->next_in = (Bytef *)( input + consumed );
+        z->avail_in = (uInt)std::min< size_t >( inputBytes - consumed , 1 << 30 );
+        z->next_out = (Bytef *)( buffer.data() + produced );
+        z->avail_out = (uInt)std::min< size_t >( buffer.size() - produced , 1 << 30 );
+        size_t availIn = z->avail_in , availOut = z->avail_out;
+        int status = inflate( z , Z_NO_FLUSH );
+        consumed += availIn - z->avail_in;
+        produced += availOut - z->avail_out;
+        if( status == Z_STREAM_END ) {
+            if( consumed == inputBytes )
+                finished = true;
+            else
+                inflateReset( z );
+        } else if( ( status != Z_OK && status != Z_BUF_ERROR ) || ( status == Z_BUF_ERROR && consumed == inputBytes ) ) {
+            // corrupted, or truncated before the end of the member
+            error = true;
+        }
+    }
+}
+
+bool GzipLines::next( const char * & begin , const char * & end ) {
+    if( stream == NULL && !error ) {
+        z_stream * z = new z_stream;
+        memset( z , 0 , sizeof( *z ) );
+        // 15 + 16 : gzip header and trailer
+        if( inflateInit2( z , 15 + 16 ) != Z_OK ) {
+            delete z;
+            error = true;
+        } else {
+            stream = z;
+            buffer.resize( blockBytes );
+        }
+    }
+    if( error )
+        return false;
+    // the unfinished line of the previous block comes first
+    std::copy( buffer.begin() + returned , buffer.begin() + produced , buffer.begin() );
+    produced -= returned;
+    returned = 0;
+    size_t searched = 0;
+    while( true ) {
+        fill();
+        if( error )
+            return false;
+        const char * text = buffer.data();
+        if( finished ) {
+            returned = produced;
+            break;
+        }
+        const char * last = text + produced;
+        while( last > text + searched && last[-1] != '\n' )
+            --last;
+        if( last > text + searched ) {
+            returned = last - text;
+            break;
+        }
+        // a line longer than the buffer
+        searched = produced;
+        buffer.resize( 2 * buffer.size() );
+    }
+    begin = buffer.data();
+    end = begin + returned;
+    return returned > 0;
+}
+
+
+static ThreadPool * loaderPool = NULL;
+
+void set_loader_pool( ThreadPool * pool ) {
+    loaderPool = pool;
+}
+
+std::vector< const char * > split_at_lines( const char * begin , const char * end ) {
+    size_t bytes = end - begin;
+    unsigned int count = 1;
+    if( loaderPool != NULL && bytes >= PARALLEL_PARSE_BYTES )
+        count = std::max( 1u , std::min( loaderPool->size() , (unsigned int)( bytes / ( PARALLEL_PARSE_BYTES / 2 ) ) ) );
+    std::vector< const char * > bounds( count + 1 , end );
+    bounds[0] = begin;
+    for( unsigned int c = 1 ; c < count ; ++c ) {
+        const char * p = std::max( bounds[c - 1] , begin + bytes * c / count );
+        const char * eol = (const char *)memchr( p , '\n' , end - p );
+        bounds[c] = eol != NULL ? eol + 1 : end;
+    }
+    return bounds;
+}
+
+void for_each_chunk( unsigned int nChunks , std::function< void( unsigned int ) > const & job ) {
+    if( loaderPool == NULL || nChunks <= 1 ) {
+        for( unsigned int c = 0 ; c < nChunks ; ++c )
+            job( c );
+        return;
+    }
+    loaderPool->parallel_for( nChunks , [&]( unsigned int c , unsigned int ) { job( c ); } );
+}
@@ -0,0 +1,87 @@
+#ifndef FILECHUNKS_H
+#define FILECHUNKS_H
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstddef>
+
+class ThreadPool;
+
+// -------------------------------------------
+// Reading and parsing of large text files, shared by the image and mesh loaders.
+// The file is mapped in memory, cut at line ends into one chunk per worker of the
+// loader pool, and the chunks are parsed in parallel on that pool.
+// -------------------------------------------
+
+// Bytes of a file : memory mapped when possible, read into a buffer otherwise
+class FileBytes {
+public:
+    FileBytes();
+    ~FileBytes();
+
+    bool open( std::string const & name );
+
+    const char * begin() const { return data; }
+    const char * end() const { return data + bytes; }
+    size_t size() const { return bytes; }
+    bool mapped() const { return mapping != NULL; }
+
+    bool isGzip() const;
+
+    // Hands the mapping over to the caller, who unmaps its size() bytes
+    void * release();
+
+private:
+    FileBytes( FileBytes const & );
+    FileBytes & operator=( FileBytes const & );
+
+    const char * data;
+    size_t bytes;
+    void * mapping;
+    std::vector< char > buffer;
+};
+
+// Streaming decompression of gzip data (concatenated members one after the other) into blocks of whole lines :
+// only one block of text is in memory at a time, whatever the size of the file. Nothing is allocated before the first
+// call to next().
+class GzipLines {
+public:
+    GzipLines( const char * begin , const char * end , size_t blockBytes = 1 << 22 );
+    ~GzipLines();
+
+    // Next block of text : it ends right after a new line, except for the last block of the stream.
+    // Returns false at the end of the stream, or on corrupted data (failed()). The block stays valid until the next call.
+    bool next( const char * & begin , const char * & end );
+    bool failed() const { return error; }
+
+private:
+    GzipLines( GzipLines const & );
+    GzipLines & operator=( GzipLines const & );
+
+    // Inflates into the free end of the buffer until it is full or the stream ends
+    void fill();
+
+    const char * input;
+    size_t inputBytes , consumed , blockBytes;
+    std::vector< char > buffer;
+    size_t produced , returned; // bytes of text in the buffer, of which the first ones were handed out by next()
+    void * stream;
+    bool finished , error;
+};
+
+// Text smaller than this is parsed on the calling thread
+const size_t PARALLEL_PARSE_BYTES = 1 << 20;
+
+// Pool the chunks run on, NULL (the default) to parse on the calling thread.
+// The loaders must not be called from a job of that pool.
+void set_loader_pool( ThreadPool * pool );
+
+// Cuts [begin,end) right after line ends into at most one chunk per worker of the loader pool, each of at least
+// PARALLEL_PARSE_BYTES / 2 bytes. Returns the chunks + 1 bounds, from begin to end.
+std::vector< const char * > split_at_lines( const char * begin , const char * end );
+
+// Runs job( chunk ) for every chunk in [0,nChunks) on the loader pool and blocks until all are done
+void for_each_chunk( unsigned int nChunks , std::function< void( unsigned int ) > const & job );
+
+#endif // FILECHUNKS_H
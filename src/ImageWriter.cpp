@@ -0,0 +1,295 @@
+#include "ImageWriter.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+ImageFormat image_format_from_filename( std::string const & filename ) {
+    std::string::size_type dot = filename.find_last_of( '.' );
+    std::string extension = dot == std::string::npos ? "" : filename.substr( dot + 1 );
+    for( unsigned int c = 0 ; c < extension.size() ; ++c )
+        extension[c] = tolower( extension[c] );
+    if( extension == "pfm" ) return ImageFormat_PFM;
+    if( extension == "exr" ) return ImageFormat_EXR;
+    return ImageFormat_PPM;
+}
+
+
+// -------------------------------------------
+// 8 bit quantization
+// -------------------------------------------
+
+static inline unsigned char quantize( float x , float invGamma ) {
+    // NaN goes to 0, as with _mm_max_ps in quantize_ps
+    x = !( x > 0.f ) ? 0.f : ( x > 1.f ? 1.f : x );
+    if( invGamma != 1.f ) x = powf( x , invGamma );
+    return (unsigned char)( 255.f * x );
+}
+
+#ifdef __SSE2__
+// x^p for x in [0,1] : exp2( p * log2( x ) ), about 1e-5 relative error, far below the 8 bit quantization step
+static inline __m128 pow_unit_ps( __m128 x , float p ) {
+    x = _mm_max_ps( x , _mm_set1_ps( 1e-30f ) );
+    // log2( x ) = e + log2( m ) , m in [1,2) ; log2( m ) = 2/ln2 * atanh( (m-1)/(m+1) )
+    __m128i bits = _mm_castps_si128( x );
+    __m128 e = _mm_cvtepi32_ps( _mm_sub_epi32( _mm_srli_epi32( bits , 23 ) , _mm_set1_epi32( 127 ) ) );
+    __m128 m = _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( bits , _mm_set1_epi32( 0x007FFFFF ) ) , _mm_set1_epi32( 0x3F800000 ) ) );
+    __m128 t = _mm_div_ps( _mm_sub_ps( m , _mm_set1_ps( 1.f ) ) , _mm_add_ps( m , _mm_set1_ps( 1.f ) ) );
+    __m128 t2 = _mm_mul_ps( t , t );
+    __m128 series = _mm_add_ps( _mm_set1_ps( 1.f / 5.f ) , _mm_mul_ps( t2 , _mm_set1_ps( 1.f / 7.f ) ) );
+    series = _mm_add_ps( _mm_set1_ps( 1.f / 3.f ) , _mm_mul_ps( t2 , series ) );
+    series = _mm_add_ps( _mm_set1_ps( 1.f ) , _mm_mul_ps( t2 , series ) );
+    __m128 log2x = _mm_add_ps( e , _mm_mul_ps( _mm_mul_ps( t , series ) , _mm_set1_ps( 2.8853900818f ) ) );
+
+    // exp2( y ) = 2^i * 2^f , i = floor( y ) , f in [0,1)
+    __m128 y = _mm_max_ps( _mm_mul_ps( log2x , _mm_set1_ps( p ) ) , _mm_set1_ps( -126.f ) );
+    __m128i i = _mm_cvttps_epi32( y );
+    __m128 fi = _mm_cvtepi32_ps( i );
+    __m128i negativeFraction = _mm_castps_si128( _mm_cmplt_ps( y , fi ) ); // truncation rounded up : all ones
+    i = _mm_add_epi32( i , negativeFraction );
+    __m128 f = _mm_sub_ps( y , _mm_cvtepi32_ps( i ) );
+    // Taylor series of exp( f ln2 )
+    __m128 a = _mm_mul_ps( f , _mm_set1_ps( 0.6931471806f ) );
+    __m128 r = _mm_add_ps( _mm_set1_ps( 1.f / 120.f ) , _mm_mul_ps( a , _mm_set1_ps( 1.f / 720.f ) ) );
+    r = _mm_add_ps( _mm_set1_ps( 1.f / 24.f ) , _mm_mul_ps( a , r ) );
+    r = _mm_add_ps( _mm_set1_ps( 1.f / 6.f ) , _mm_mul_ps( a , r ) );
+    r = _mm_add_ps( _mm_set1_ps( 0.5f ) , _mm_mul_ps( a , r ) );
+    r = _mm_add_ps( _mm_set1_ps( 1.f ) , _mm_mul_ps( a , r ) );
+    r = _mm_add_ps( _mm_set1_ps( 1.f ) , _mm_mul_ps( a , r ) );
+    return _mm_castsi128_ps( _mm_add_epi32( _mm_castps_si128( r ) , _mm_slli_epi32( i , 23 ) ) );
+}
+
+static inline __m128i quantize_ps( __m128 v , float invGamma ) {
+    v = _mm_min_ps( _mm_max_ps( v , _mm_setzero_ps() ) , _mm_set1_ps( 1.f ) );
+    if( invGamma != 1.f ) v = pow_unit_ps( v , invGamma );
+    return _mm_cvttps_epi32( _mm_mul_ps( v , _mm_set1_ps( 255.f ) ) );
+}
+#endif
+
+void quantize_rgb8( Vec3 const * image , unsigned int nPixels , float gamma , unsigned char * out ) {
+    float invGamma = 1.f / gamma;
+    unsigned int done = 0;
+#ifdef __SSE2__
+    if( sizeof( Vec3 ) == 3 * sizeof( float ) ) {
+        // the pixels are one flat float array : 16 channels per iteration
+        float const * channels = reinterpret_cast< float const * >( image );
+        unsigned int nChannels = 3 * nPixels;
+        unsigned int c = 0;
+        for( ; c + 16 <= nChannels ; c += 16 ) {
+            __m128i q0 = quantize_ps( _mm_loadu_ps( channels + c ) , invGamma );
+            __m128i q1 = quantize_ps( _mm_loadu_ps( channels + c + 4 ) , invGamma );
+            __m128i q2 = quantize_ps( _mm_loadu_ps( channels + c + 8 ) , invGamma );
+            __m128i q3 = quantize_ps( _mm_loadu_ps( channels + c + 12 ) , invGamma );
+            __m128i packed = _mm_packus_epi16( _mm_packs_epi32( q0 , q1 ) , _mm_packs_epi32( q2 , q3 ) );
+            _mm_storeu_si128( (__m128i *)( out + c ) , packed );
+        }
+        for( ; c < nChannels ; ++c )
+            out[c] = quantize( channels[c] , invGamma );
+        done = nPixels;
+    }
+    else if( sizeof( Vec3 ) == 4 * sizeof( float ) ) {
+        // SIMD Vec3 (see Vec3.h) : one pixel per register, the padding lane is dropped
+        float const * channels = reinterpret_cast< float const * >( image );
+        for( ; done < nPixels ; ++done ) {
+            int q[4];
+            _mm_storeu_si128( (__m128i *)q , quantize_ps( _mm_loadu_ps( channels + 4 * done ) , invGamma ) );
+            out[3 * done + 0] = (unsigned char)q[0];
+            out[3 * done + 1] = (unsigned char)q[1];
+            out[3 * done + 2] = (unsigned char)q[2];
+        }
+    }
+#endif
+    for( unsigned int i = done ; i < nPixels ; ++i ) {
+        out[3 * i + 0] = quantize( image[i][0] , invGamma );
+        out[3 * i + 1] = quantize( image[i][1] , invGamma );
+        out[3 * i + 2] = quantize( image[i][2] , invGamma );
+    }
+}
+
+
+// -------------------------------------------
+// Encoders
+// -------------------------------------------
+
+static bool write_ppm( std::ofstream & f , std::vector< Vec3 > const & image , int w , int h , float gamma ) {
+    std::vector< unsigned char > bytes( 3 * w * h );
+    quantize_rgb8( image.data() , w * h , gamma , bytes.data() );
+    f << "P6\n" << w << " " << h << "\n255\n";
+    f.write( (char const *)bytes.data() , bytes.size() );
+    return f.good();
+}
+
+static bool write_pfm( std::ofstream & f , std::vector< Vec3 > const & image , int w , int h ) {
+    // negative scale : little endian. PFM rows go from the bottom of the image to the top.
+    f << "PF\n" << w << " " << h << "\n-1.0\n";
+    std::vector< float > row( 3 * w );
+    for( int y = h - 1 ; y >= 0 ; --y ) {
+        for( int x = 0 ; x < w ; ++x ) {
+            row[3 * x + 0] = image[x + y * w][0];
+            row[3 * x + 1] = image[x + y * w][1];
+            row[3 * x + 2] = image[x + y * w][2];
+        }
+        f.write( (char const *)row.data() , row.size() * sizeof( float ) );
+    }
+    return f.good();
+}
+
+static uint16_t float_to_half( float value ) {
+    uint32_t x;
+    memcpy( &x , &value , sizeof( x ) );
+    uint16_t sign = ( x >> 16 ) & 0x8000;
+    uint32_t mantissa = x & 0x007FFFFF;
+    int exponent = (int)( ( x >> 23 ) & 0xFF ) - 127 + 15;
+    if( ( x & 0x7FFFFFFF ) >= 0x7F800000 ) return sign | 0x7C00 | ( mantissa ? 0x200 : 0 ); // inf , nan
+    if( exponent >= 31 ) return sign | 0x7C00; // overflow
+    if( exponent <= 0 ) { // denormal half
+        if( exponent < -10 ) return sign;
+        mantissa |= 0x00800000;
+        int shift = 14 - exponent;
+        uint16_t half = (uint16_t)( mantissa >> shift );
+        if( ( mantissa >> ( shift - 1 ) ) & 1 ) ++half;
+        return sign | half;
+    }
+    uint16_t half = sign | (uint16_t)( exponent << 10 ) | (uint16_t)( mantissa >> 13 );
+    if( mantissa & 0x1000 ) ++half; // a carry correctly bumps the exponent
+    return half;
+}
+
+static void put_int32( std::string & s , int32_t v ) { s.append( (char const *)&v , 4 ); }
+static void put_float( std::string & s , float v ) { s.append( (char const *)&v , 4 ); }
+static void put_attribute( std::string & header , char const * name , char const * type , std::string const & value ) {
+    header.append( name ); header.push_back( 0 );
+    header.append( type ); header.push_back( 0 );
+    put_int32( header , (int32_t)value.size() );
+    header.append( value );
+}
+
+static bool write_exr( std::ofstream & f , std::vector< Vec3 > const & image , int w , int h ) {
+    // single part scanline file, no compression, one line per block. EXR is little endian, as are our targets.
+    std::string header;
+    put_int32( header , 20000630 );
+    put_int32( header , 2 );
+
+    std::string channels;
+    char const * names[3] = { "B" , "G" , "R" }; // channels are sorted by name
+    for( int c = 0 ; c < 3 ; ++c ) {
+        channels.append( names[c] ); channels.push_back( 0 );
+        put_int32( channels , 1 ); // HALF
+        channels.append( 4 , '\0' ); // pLinear , reserved
+        put_int32( channels , 1 ); // x sampling
+        put_int32( channels , 1 ); // y sampling
+    }
+    channels.push_back( 0 );
+    put_attribute( header , "channels" , "chlist" , channels );
+    put_attribute( header , "compression" , "compression" , std::string( 1 , '\0' ) );
+    std::string window;
+    put_int32( window , 0 ); put_int32( window , 0 ); put_int32( window , w - 1 ); put_int32( window , h - 1 );
+    put_attribute( header , "dataWindow" , "box2i" , window );
+    put_attribute( header , "displayWindow" , "box2i" , window );
+    put_attribute( header , "lineOrder" , "lineOrder" , std::string( 1 , '\0' ) );
+    std::string value;
+    put_float( value , 1.f );
+    put_attribute( header , "pixelAspectRatio" , "float" , value );
+    value.clear(); put_float( value , 0.f ); put_float( value , 0.f );
+    put_attribute( header , "screenWindowCenter" , "v2f" , value );
+    value.clear(); put_float( value , 1.f );
+    put_attribute( header , "screenWindowWidth" , "float" , value );
+    header.push_back( 0 );
+
+    uint64_t lineSize = 3 * (uint64_t)w * sizeof( uint16_t );
+    uint64_t firstLine = header.size() + h * sizeof( uint64_t );
+    std::vector< uint64_t > offsets( h );
+    for( int y = 0 ; y < h ; ++y )
+        offsets[y] = firstLine + y * ( 8 + lineSize );
+    f.write( header.data() , header.size() );
+    f.write( (char const *)offsets.data() , offsets.size() * sizeof( uint64_t ) );
+
+    std::vector< uint16_t > line( 3 * w );
+    for( int y = 0 ; y < h ; ++y ) {
+        for( int x = 0 ; x < w ; ++x ) {
+            Vec3 const & p = image[x + y * w];
+            line[x] = float_to_half( p[2] );
+            line[w + x] = float_to_half( p[1] );
+            line[2 * w + x] = float_to_half( p[0] );
+        }
+        int32_t lineHeader[2] = { y , (int32_t)lineSize };
+        f.write( (char const *)lineHeader , sizeof( lineHeader ) );
+        f.write( (char const *)line.data() , lineSize );
+    }
+    return f.good();
+}
+
+bool write_image( std::string const & filename , std::vector< Vec3 > const & image , int w , int h , ImageFormat format , float gamma ) {
+    std::ofstream f( filename.c_str() , std::ios::binary );
+    if( f.fail() ) {
+        std::cout << "Could not open file: " << filename << std::endl;
+        return false;
+    }
+    bool ok = false;
+    switch( format ) {
+    case ImageFormat_PPM: ok = write_ppm( f , image , w , h , gamma ); break;
+    case ImageFormat_PFM: ok = write_pfm( f , image , w , h ); break;
+    case ImageFormat_EXR: ok = write_exr( f , image , w , h ); break;
+    }
+    f.close();
+    if( !ok ) std::cout << "Could not write file: " << filename << std::endl;
+    return ok;
+}
+
+
+// -------------------------------------------
+// Background writer
+// -------------------------------------------
+
+AsyncImageWriter::AsyncImageWriter() : busy( false ) , stopping( false ) {
+    worker = std::thread( &AsyncImageWriter::run , this );
+}
+
+AsyncImageWriter::~AsyncImageWriter() {
+    {
+        std::unique_lock< std::mutex > guard( lock );
+        stopping = true;
+    }
+    jobAdded.notify_one();
+    worker.join();
+}
+
+void AsyncImageWriter::write( std::string const & filename , std::vector< Vec3 > & image , int w , int h , float gamma ) {
+    std::unique_lock< std::mutex > guard( lock );
+    jobs.push_back( Job() );
+    Job & job = jobs.back();
+    job.filename = filename;
+    job.image.swap( image );
+    job.w = w;
+    job.h = h;
+    job.gamma = gamma;
+    jobAdded.notify_one();
+}
+
+void AsyncImageWriter::flush() {
+    std::unique_lock< std::mutex > guard( lock );
+    jobDone.wait( guard , [this]{ return jobs.empty() && !busy; } );
+}
+
+void AsyncImageWriter::run() {
+    std::unique_lock< std::mutex > guard( lock );
+    while( true ) {
+        jobAdded.wait( guard , [this]{ return stopping || !jobs.empty(); } );
+        // the queue is drained before stopping
+        if( jobs.empty() ) return;
+        Job job;
+        std::swap( job , jobs.front() );
+        jobs.pop_front();
+        busy = true;
+        guard.unlock();
+        write_image( job.filename , job.image , job.w , job.h , image_format_from_filename( job.filename ) , job.gamma );
+        guard.lock();
+        busy = false;
+        jobDone.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Vec3.h"
+
+// -------------------------------------------
+// Image output.
+// Rows are stored from the top of the image to the bottom, as the ray tracer produces them.
+// -------------------------------------------
+
+enum ImageFormat {
+    ImageFormat_PPM ,   // binary P6, 8 bits per channel
+    ImageFormat_PFM ,   // 32 bit float, little endian
+    ImageFormat_EXR     // OpenEXR, 16 bit half float, uncompressed scanlines
+};
+
+// format from the file extension (.ppm, .pfm, .exr); anything else is written as .ppm
+ImageFormat image_format_from_filename( std::string const & filename );
+
+// Clamps to [0,1], applies the 1/gamma exponent and quantizes to 8 bits : 3*nPixels bytes
+void quantize_rgb8( Vec3 const * image , unsigned int nPixels , float gamma , unsigned char * out );
+
+bool write_image( std::string const & filename , std::vector< Vec3 > const & image , int w , int h ,
+                  ImageFormat format , float gamma = 1.f );
+
+
+// Encodes and writes images on a background thread : write() returns as soon as the image is queued.
+class AsyncImageWriter {
+public:
+    AsyncImageWriter();
+    ~AsyncImageWriter(); // writes everything still queued
+
+    // the image is moved into the queue
+    void write( std::string const & filename , std::vector< Vec3 > & image , int w , int h , float gamma = 1.f );
+    // blocks until every queued image is on disk
+    void flush();
+
+private:
+    struct Job {
+        std::string filename;
+        std::vector< Vec3 > image;
+        int w , h;
+        float gamma;
+    };
+    void run();
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable jobAdded , jobDone;
+    std::deque< Job > jobs;
+    bool busy , stopping;
+};
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,173 @@
+#ifndef LIGHTBVH_H
+#define LIGHTBVH_H
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "Vec3.h"
+#include "BVH.h"
+
+// -------------------------------------------
+// Light hierarchy, to pick a few lights out of thousands at a shading point.
+// Every node bounds its lights by a box, their total power and a cone of emission directions. The importance
+// of a node for a shading point estimates what its lights can bring there; a light is picked by going down the
+// tree, each child being taken with a probability proportional to its importance. The probability of the light
+// is returned with it, so that the estimator stays unbiased : the importance only has to be non zero wherever
+// a light of the node can contribute.
+// -------------------------------------------
+
+// Emission of one light, or of a node : every direction within acosf( cosTheta ) of axis (cosTheta = -1 : all directions)
+struct LightBounds {
+    AABB bounds;
+    float power;
+    Vec3 axis;
+    float cosTheta;
+    // distance at which the intensity falls to one half, 0 if it does not fall off (see Light::range)
+    float range;
+
+    LightBounds() : power( 0.f ) , axis( 0.f , 0.f , 1.f ) , cosTheta( -1.f ) , range( 0.f ) {}
+
+    void extend( LightBounds const & other ) {
+        if( bounds.empty() ) {
+            *this = other;
+            return;
+        }
+        bounds.extend( other.bounds );
+        power += other.power;
+        range = ( range <= 0.f || other.range <= 0.f ) ? 0.f : std::max( range , other.range );
+        // conservative union of the cones, around the mean axis
+        if( cosTheta <= -1.f || other.cosTheta <= -1.f ) {
+            cosTheta = -1.f;
+            return;
+        }
+        Vec3 mean = axis + other.axis;
+        float length = mean.length();
+        if( length < 1e-6f ) {
+            cosTheta = -1.f;
+            return;
+        }
+        mean /= length;
+        float theta = std::max( angle( mean , axis ) + acosf( cosTheta ) , angle( mean , other.axis ) + acosf( other.cosTheta ) );
+        axis = mean;
+        cosTheta = theta >= (float)M_PI ? -1.f : cosf( theta );
+    }
+
+    // Importance for a point p of normal n : power, times the falloff at the distance of the box, times the best
+    // cosine between n and a direction towards the box. Zero if p is outside the emission cone, or if the whole box
+    // is below the horizon of p.
+    float importance( Vec3 const & p , Vec3 const & n ) const {
+        if( power <= 0.f ) return 0.f;
+        Vec3 center = bounds.center();
+        Vec3 diagonal( bounds.bmax[0] - bounds.bmin[0] , bounds.bmax[1] - bounds.bmin[1] , bounds.bmax[2] - bounds.bmin[2] );
+        float radius2 = 0.25f * diagonal.squareLength();
+        Vec3 toPoint = p - center;
+        float distance2 = toPoint.squareLength();
+        if( distance2 <= radius2 ) return power;
+
+        // angular radius of the bounding sphere of the box, seen from p
+        float sinThetaU = sqrtf( radius2 / distance2 );
+        float thetaU = asinf( std::min( 1.f , sinThetaU ) );
+        Vec3 direction = toPoint / sqrtf( distance2 );
+
+        if( cosTheta > -1.f ) {
+            float thetaW = angle( axis , direction );
+            if( thetaW - acosf( cosTheta ) - thetaU > 0.f ) return 0.f;
+        }
+        float thetaI = angle( n , -1.f * direction );
+        float cosThetaI = cosf( std::max( 0.f , thetaI - thetaU ) );
+        if( cosThetaI <= 0.f ) return 0.f;
+
+        float falloff = 1.f;
+        if( range > 0.f ) falloff = range * range / ( range * range + std::max( distance2 , radius2 ) );
+        return power * falloff * cosThetaI;
+    }
+
+    static float angle( Vec3 const & a , Vec3 const & b ) {
+        return acosf( std::max( -1.f , std::min( 1.f , Vec3::dot( a , b ) ) ) );
+    }
+};
+
+class LightBVH {
+public:
+    void clear() { nodes.clear(); }
+    bool empty() const { return nodes.empty(); }
+
+    void build( std::vector< LightBounds > const & lights ) {
+        clear();
+        std::vector< unsigned int > indices;
+        for( unsigned int i = 0 ; i < lights.size() ; ++i )
+            if( lights[i].power > 0.f ) indices.push_back( i );
+        if( indices.empty() ) return;
+        nodes.reserve( 2 * indices.size() );
+        buildRecursive( lights , indices , 0 , indices.size() );
+    }
+
+    // Picks a light seen from p (normal n) with u uniform in [0,1). Returns false if no light can reach p.
+    bool sample( Vec3 const & p , Vec3 const & n , float u , unsigned int & light , float & pdf ) const {
+        if( nodes.empty() ) return false;
+        unsigned int index = 0;
+        pdf = 1.f;
+        if( nodes[0].bounds.importance( p , n ) <= 0.f ) return false;
+        while( nodes[index].light < 0 ) {
+            unsigned int left = index + 1 , right = nodes[index].right;
+            float importanceLeft = nodes[left].bounds.importance( p , n ) , importanceRight = nodes[right].bounds.importance( p , n );
+            if( importanceLeft <= 0.f && importanceRight <= 0.f ) return false;
+            float probabilityLeft = importanceLeft / ( importanceLeft + importanceRight );
+            if( u < probabilityLeft ) {
+                index = left;
+                u = std::min( u / probabilityLeft , 0x1.fffffep-1f );
+                pdf *= probabilityLeft;
+            } else {
+                index = right;
+                u = std::min( ( u - probabilityLeft ) / ( 1.f - probabilityLeft ) , 0x1.fffffep-1f );
+                pdf *= 1.f - probabilityLeft;
+            }
+        }
+        light = nodes[index].light;
+        return true;
+    }
+
+private:
+    // depth first layout : the left child follows its parent, right is the index of the right child
+    struct Node {
+        LightBounds bounds;
+        unsigned int right;
+        int light; // index of the light of a leaf, -1 for an inner node
+    };
+
+    // split in two halves along the widest axis of the light centers
+    unsigned int buildRecursive( std::vector< LightBounds > const & lights , std::vector< unsigned int > & indices , unsigned int begin , unsigned int end ) {
+        unsigned int nodeIndex = nodes.size();
+        nodes.push_back( Node() );
+        LightBounds bounds;
+        AABB centers;
+        for( unsigned int i = begin ; i < end ; ++i ) {
+            bounds.extend( lights[indices[i]] );
+            centers.extend( lights[indices[i]].bounds.center() );
+        }
+        nodes[nodeIndex].bounds = bounds;
+        if( end - begin == 1 ) {
+            nodes[nodeIndex].light = indices[begin];
+            nodes[nodeIndex].right = 0;
+            return nodeIndex;
+        }
+        int axis = 0;
+        for( int c = 1 ; c < 3 ; ++c )
+            if( centers.bmax[c] - centers.bmin[c] > centers.bmax[axis] - centers.bmin[axis] ) axis = c;
+        unsigned int middle = ( begin + end ) / 2;
+        std::nth_element( indices.begin() + begin , indices.begin() + middle , indices.begin() + end , [&]( unsigned int a , unsigned int b ) {
+            return lights[a].bounds.center()[axis] < lights[b].bounds.center()[axis];
+        } );
+        nodes[nodeIndex].light = -1;
+        buildRecursive( lights , indices , begin , middle );
+        unsigned int right = buildRecursive( lights , indices , middle , end );
+        nodes[nodeIndex].right = right;
+        return nodeIndex;
+    }
+
+    std::vector< Node > nodes;
+};
+
+#endif // LIGHTBVH_H
@@ -26,8 +26,15 @@ struct Material {
 
     MaterialType type;
 
+    // texture modulating color, index in the textures of the scene, -1 if none
+    int texture;
+    // tangent space normal map perturbing the shading normal, index in the textures of the scene, -1 if none
+    int normalMap;
+
     Material() {
         type = Material_Diffuse_Blinn_Phong;
+        texture = -1;
+        normalMap = -1;
         transparency = 0.0;
         index_medium = 1.0;
         color = Vec3(0., 0., 0.);
@@ -1,25 +1,305 @@
 #include "Mesh.h"
+#include "FileChunks.h"
 #include <iostream>
 #include <fstream>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
 
-void Mesh::loadOFF (const std::string & filename) {
-    std::ifstream in (filename.c_str ());
-    if (!in)
-        exit (EXIT_FAILURE);
-    std::string offString;
-    unsigned int sizeV, sizeT, tmp;
-    in >> offString >> sizeV >> sizeT >> tmp;
-    vertices.resize (sizeV);
-    triangles.resize (sizeT);
-    for (unsigned int i = 0; i < sizeV; i++)
-        in >> vertices[i].position;
-    int s;
-    for (unsigned int i = 0; i < sizeT; i++) {
-        in >> s;
-        for (unsigned int j = 0; j < 3; j++)
-            in >> triangles[i].v[j];
+namespace {
+
+// Binary sidecar of an OFF file (file.off.cache) : this header, 3 floats per vertex, 3 indices per triangle.
+// It is valid as long as the size and modification time of the source are the ones it was written from.
+const char CACHE_MAGIC[8] = { 'O', 'F', 'F', 'C', 'A', 'C', 'H', '1' };
+struct CacheHeader {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceTime; // nanoseconds
+    uint32_t vertexCount, triangleCount;
+};
+
+int64_t modificationTime (const struct stat & st) {
+    return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool isBlank (char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+const char * lineEnd (const char * p, const char * end) {
+    const char * q = (const char *) memchr (p, '\n', end - p);
+    return q != NULL ? q : end;
+}
+
+// Start of the data of a line, NULL if the line is blank or a comment
+const char * lineData (const char * p, const char * eol) {
+    while (p < eol && isBlank (*p))
+        p++;
+    return (p == eol || *p == '#') ? NULL : p;
+}
+
+// Next token of a header : white space, new lines and comments are skipped
+const char * headerToken (const char * p, const char * end) {
+    while (p < end) {
+        if (*p == '#')
+            p = lineEnd (p, end);
+        else if (isBlank (*p) || *p == '\n')
+            p++;
+        else
+            break;
+    }
+    return p;
+}
+
+template <class T>
+const char * parseNumber (const char * p, const char * eol, T & value) {
+    while (p < eol && isBlank (*p))
+        p++;
+    std::from_chars_result result = std::from_chars (p, eol, value);
+    return result.ec == std::errc () ? result.ptr : NULL;
+}
+
+// Lines with data in [p, end)
+size_t countDataLines (const char * p, const char * end) {
+    size_t count = 0;
+    while (p < end) {
+        const char * eol = lineEnd (p, end);
+        if (lineData (p, eol) != NULL)
+            count++;
+        p = eol + 1;
     }
-    in.close ();
+    return count;
+}
+
+// One chunk of the body of an OFF file : its data lines are the lines firstLine, firstLine + 1, ... of the body.
+// Vertices are written in place, the triangles of the faces (fans of the polygons) are kept by the chunk.
+struct BodyChunk {
+    const char * begin, * end;
+    size_t firstLine;
+    std::vector<unsigned int> triangles;
+    std::string error;
+
+    void parse (std::vector<MeshVertex> & vertices, size_t faceCount) {
+        size_t vertexCount = vertices.size ();
+        size_t line = firstLine;
+        for (const char * p = begin; p < end && line < vertexCount + faceCount; ) {
+            const char * eol = lineEnd (p, end);
+            const char * q = lineData (p, eol);
+            p = eol + 1;
+            if (q == NULL)
+                continue;
+            if (line < vertexCount) {
+                Vec3 & position = vertices[line].position;
+                for (unsigned int c = 0; c < 3 && q != NULL; c++)
+                    q = parseNumber (q, eol, position[c]);
+                if (q == NULL) {
+                    error = "invalid vertex " + std::to_string (line);
+                    return;
+                }
+            } else {
+                unsigned int corners = 0, first = 0, previous = 0, index = 0;
+                q = parseNumber (q, eol, corners);
+                for (unsigned int k = 0; k < corners && q != NULL; k++) {
+                    q = parseNumber (q, eol, index);
+                    if (q == NULL || index >= vertexCount)
+                        break;
+                    if (k == 0)
+                        first = index;
+                    else if (k >= 2) {
+                        triangles.push_back (first);
+                        triangles.push_back (previous);
+                        triangles.push_back (index);
+                    }
+                    previous = index;
+                }
+                if (q == NULL || index >= vertexCount) {
+                    error = "invalid face " + std::to_string (line - vertexCount);
+                    return;
+                }
+            }
+            line++;
+        }
+    }
+};
+
+// Parses the body lines in [p, end) on the loader pool. The first data line there is the line `lines` of the body,
+// which is then moved past them. Vertices are written in place, the triangles appended to indices.
+// Returns false, with the error of the first invalid line, if there is one.
+bool parseBody (const char * p, const char * end, size_t & lines, std::vector<MeshVertex> & vertices, size_t faceCount,
+                std::vector<unsigned int> & indices, std::string & error) {
+    std::vector<const char *> bounds = split_at_lines (p, end);
+    std::vector<BodyChunk> chunks (bounds.size () - 1);
+    for (unsigned int c = 0; c < chunks.size (); c++) {
+        chunks[c].begin = bounds[c];
+        chunks[c].end = bounds[c + 1];
+    }
+    for_each_chunk (chunks.size (), [&] (unsigned int c) {
+        chunks[c].firstLine = countDataLines (chunks[c].begin, chunks[c].end);
+    });
+    for (unsigned int c = 0; c < chunks.size (); c++) {
+        size_t count = chunks[c].firstLine;
+        chunks[c].firstLine = lines;
+        lines += count;
+    }
+    for_each_chunk (chunks.size (), [&] (unsigned int c) {
+        chunks[c].parse (vertices, faceCount);
+    });
+    for (unsigned int c = 0; c < chunks.size (); c++) {
+        if (!chunks[c].error.empty ()) {
+            error = chunks[c].error;
+            return false;
+        }
+        indices.insert (indices.end (), chunks[c].triangles.begin (), chunks[c].triangles.end ());
+    }
+    return true;
+}
+
+bool readCache (const std::string & name, const struct stat & source, std::vector<MeshVertex> & vertices, std::vector<MeshTriangle> & triangles) {
+    FileBytes file;
+    if (!file.open (name) || file.size () < sizeof (CacheHeader))
+        return false;
+    CacheHeader header;
+    memcpy (&header, file.begin (), sizeof (header));
+    if (memcmp (header.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC)) != 0 || header.sourceSize != (uint64_t) source.st_size
+        || header.sourceTime != modificationTime (source)
+        || file.size () != sizeof (header) + 3 * sizeof (float) * header.vertexCount + 3 * sizeof (uint32_t) * header.triangleCount)
+        return false;
+    const char * p = file.begin () + sizeof (header);
+    vertices.resize (header.vertexCount);
+    for (unsigned int i = 0; i < header.vertexCount; i++, p += 3 * sizeof (float)) {
+        float position[3];
+        memcpy (position, p, sizeof (position));
+        vertices[i].position = Vec3 (position[0], position[1], position[2]);
+    }
+    triangles.resize (header.triangleCount);
+    for (unsigned int i = 0; i < header.triangleCount; i++, p += 3 * sizeof (uint32_t)) {
+        uint32_t v[3];
+        memcpy (v, p, sizeof (v));
+        if (v[0] >= header.vertexCount || v[1] >= header.vertexCount || v[2] >= header.vertexCount) {
+            vertices.clear ();
+            triangles.clear ();
+            return false;
+        }
+        triangles[i] = MeshTriangle (v[0], v[1], v[2]);
+    }
+    return true;
+}
+
+// Written next to the source through a temporary file, so that a reader never sees half a cache.
+// A directory that cannot be written to only costs the cache.
+void writeCache (const std::string & name, const struct stat & source, const std::vector<MeshVertex> & vertices, const std::vector<MeshTriangle> & triangles) {
+    CacheHeader header;
+    memcpy (header.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC));
+    header.sourceSize = source.st_size;
+    header.sourceTime = modificationTime (source);
+    header.vertexCount = vertices.size ();
+    header.triangleCount = triangles.size ();
+    std::vector<char> bytes (sizeof (header) + 3 * sizeof (float) * vertices.size () + 3 * sizeof (uint32_t) * triangles.size ());
+    char * p = bytes.data ();
+    memcpy (p, &header, sizeof (header));
+    p += sizeof (header);
+    for (unsigned int i = 0; i < vertices.size (); i++, p += 3 * sizeof (float)) {
+        float position[3] = { vertices[i].position[0], vertices[i].position[1], vertices[i].position[2] };
+        memcpy (p, position, sizeof (position));
+    }
+    for (unsigned int i = 0; i < triangles.size (); i++, p += 3 * sizeof (uint32_t)) {
+        uint32_t v[3] = { triangles[i][0], triangles[i][1], triangles[i][2] };
+        memcpy (p, v, sizeof (v));
+    }
+    std::string temporary = name + "." + std::to_string (getpid ());
+    std::ofstream out (temporary.c_str (), std::ios::binary);
+    if (!out)
+        return;
+    out.write (bytes.data (), bytes.size ());
+    out.close ();
+    if (!out || rename (temporary.c_str (), name.c_str ()) != 0)
+        unlink (temporary.c_str ());
+}
+
+}
+
+// OFF file, possibly gzip compressed : "OFF" (or a variant such as "COFF", whose extra values are ignored), the
+// numbers of vertices, faces and edges, then one vertex per line and one face per line. Comments start with '#'.
+// Polygons are cut into fans of triangles. Large files are parsed in chunks on the loader pool, each chunk counting
+// its lines first so that it knows which vertices and faces it holds. Returns false, with an empty mesh, on an error.
+bool Mesh::loadOFF (const std::string & filename) {
+    vertices.clear ();
+    triangles.clear ();
+    invalidate_arrays ();
+    struct stat source;
+    if (stat (filename.c_str (), &source) != 0) {
+        std::cerr << "Could not open file: " << filename << std::endl;
+        return false;
+    }
+    std::string cacheName = filename + ".cache";
+    if (readCache (cacheName, source, vertices, triangles)) {
+        invalidate_arrays ();
+        return true;
+    }
+
+    FileBytes file;
+    if (!file.open (filename)) {
+        std::cerr << "Could not open file: " << filename << std::endl;
+        return false;
+    }
+    // a gzip file is inflated a block of lines at a time, each block parsed before the next one is inflated
+    bool gzipped = file.isGzip ();
+    GzipLines gzip (file.begin (), file.end ());
+    const char * p = file.begin ();
+    const char * end = file.end ();
+    if (gzipped && !gzip.next (p, end))
+        p = end = NULL;
+
+    // header : the keyword is optional
+    p = headerToken (p, end);
+    const char * keyword = p;
+    while (p < end && !isBlank (*p) && *p != '\n' && *p != '#')
+        p++;
+    if (p - keyword >= 3 && memcmp (p - 3, "OFF", 3) == 0)
+        p = headerToken (p, end);
+    else
+        p = keyword;
+    size_t counts[3] = { 0, 0, 0 };
+    for (unsigned int i = 0; i < 3 && p != NULL; i++)
+        p = parseNumber (headerToken (p, end), end, counts[i]);
+    // a vertex or a face line takes at least 6 bytes, and deflate compresses at most 1032 times
+    size_t maxLines = (gzipped ? 1032 : 1) * (file.size () / 6);
+    if (gzip.failed () || p == NULL || counts[0] == 0 || counts[0] > maxLines || counts[1] > maxLines || counts[0] > UINT32_MAX) {
+        std::cerr << (gzip.failed () ? "Corrupted gzip file: " : "Invalid OFF header: ") << filename << std::endl;
+        return false;
+    }
+    p = std::min (end, lineEnd (p, end) + 1);
+    size_t vertexCount = counts[0], faceCount = counts[1];
+
+    vertices.resize (vertexCount);
+    std::vector<unsigned int> indices;
+    size_t lines = 0;
+    std::string error;
+    bool parsed = parseBody (p, end, lines, vertices, faceCount, indices, error);
+    while (parsed && gzipped && lines < vertexCount + faceCount && gzip.next (p, end))
+        parsed = parseBody (p, end, lines, vertices, faceCount, indices, error);
+    if (gzip.failed ())
+        std::cerr << "Corrupted gzip file: " << filename << std::endl;
+    else if (!parsed)
+        std::cerr << "Invalid OFF file: " << filename << ", " << error << std::endl;
+    else if (lines < vertexCount + faceCount)
+        std::cerr << "Truncated OFF file: " << filename << std::endl;
+    if (gzip.failed () || !parsed || lines < vertexCount + faceCount) {
+        vertices.clear ();
+        triangles.clear ();
+        return false;
+    }
+
+    triangles.resize (indices.size () / 3);
+    for (size_t t = 0; t < triangles.size (); t++)
+        triangles[t] = MeshTriangle (indices[3 * t], indices[3 * t + 1], indices[3 * t + 2]);
+
+    writeCache (cacheName, source, vertices, triangles);
+    invalidate_arrays ();
+    return true;
 }
 
 void Mesh::recomputeNormals () {
@@ -37,7 +317,45 @@ void Mesh::recomputeNormals () {
         vertices[i].normal.normalize ();
 }
 
+// Tangent frames for normal mapping (Lengyel) : every triangle adds its directions of increasing u and v to its
+// corners, the sum of the u directions is then made orthogonal to the vertex normal and the v directions give the
+// handedness. Vertices without usable texture coordinates get any tangent orthogonal to their normal.
+void Mesh::recomputeTangents () {
+    std::vector<Vec3> sDirections (vertices.size (), Vec3 (0.0, 0.0, 0.0));
+    std::vector<Vec3> tDirections (vertices.size (), Vec3 (0.0, 0.0, 0.0));
+    for (unsigned int i = 0; i < triangles.size (); i++) {
+        const MeshVertex & v0 = vertices[triangles[i].v[0]];
+        const MeshVertex & v1 = vertices[triangles[i].v[1]];
+        const MeshVertex & v2 = vertices[triangles[i].v[2]];
+        Vec3 e01 = v1.position - v0.position;
+        Vec3 e02 = v2.position - v0.position;
+        float du1 = v1.u - v0.u, dv1 = v1.v - v0.v;
+        float du2 = v2.u - v0.u, dv2 = v2.v - v0.v;
+        float det = du1 * dv2 - du2 * dv1;
+        if (fabs (det) < 1e-12f)
+            continue;
+        float r = 1.f / det;
+        Vec3 s = r * (dv2 * e01 - dv1 * e02);
+        Vec3 t = r * (du1 * e02 - du2 * e01);
+        for (unsigned int j = 0; j < 3; j++) {
+            sDirections[triangles[i].v[j]] += s;
+            tDirections[triangles[i].v[j]] += t;
+        }
+    }
+    for (unsigned int i = 0; i < vertices.size (); i++) {
+        const Vec3 & n = vertices[i].normal;
+        Vec3 tangent = sDirections[i] - Vec3::dot (sDirections[i], n) * n;
+        if (tangent.squareLength () < 1e-12f)
+            tangent = n.getOrthogonal ();
+        tangent.normalize ();
+        vertices[i].tangent = tangent;
+        vertices[i].handedness = Vec3::dot (Vec3::cross (n, tangent), tDirections[i]) < 0.f ? -1.f : 1.f;
+    }
+}
+
 void Mesh::centerAndScaleToUnit () {
+    bake_transform ();
+    arrays_dirty = true;
     Vec3 c(0,0,0);
     for  (unsigned int i = 0; i < vertices.size (); i++)
         c += vertices[i].position;
@@ -8,6 +8,7 @@
 #include "Ray.h"
 #include "Triangle.h"
 #include "Material.h"
+#include "BVH.h"
 
 #include <GL/glut.h>
 
@@ -19,21 +20,26 @@
 // -------------------------------------------
 
 struct MeshVertex {
-    inline MeshVertex () {}
-    inline MeshVertex (const Vec3 & _p, const Vec3 & _n) : position (_p), normal (_n) , u(0) , v(0) {}
-    inline MeshVertex (const MeshVertex & vertex) : position (vertex.position), normal (vertex.normal) , u(vertex.u) , v(vertex.v) {}
+    inline MeshVertex () : u(0) , v(0) , handedness(1) {}
+    inline MeshVertex (const Vec3 & _p, const Vec3 & _n) : position (_p), normal (_n) , u(0) , v(0) , tangent(1,0,0) , handedness(1) {}
+    inline MeshVertex (const MeshVertex & vertex) : position (vertex.position), normal (vertex.normal) , u(vertex.u) , v(vertex.v) ,
+        tangent(vertex.tangent) , handedness(vertex.handedness) {}
     inline virtual ~MeshVertex () {}
     inline MeshVertex & operator = (const MeshVertex & vertex) {
         position = vertex.position;
         normal = vertex.normal;
         u = vertex.u;
         v = vertex.v;
+        tangent = vertex.tangent;
+        handedness = vertex.handedness;
         return (*this);
     }
     // membres :
     Vec3 position; // une position
     Vec3 normal; // une normale
     float u,v; // coordonnees uv
+    Vec3 tangent; // direction de u croissant, orthogonale a la normale
+    float handedness; // +1 ou -1 : la direction de v croissant est handedness * cross(normal, tangent)
 };
 
 struct MeshTriangle {
@@ -62,7 +68,7 @@ struct MeshTriangle {
 
 class Mesh {
 protected:
-    void build_positions_array() {
+    void build_positions_array() const {
         positions_array.resize( 3 * vertices.size() );
         for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
             positions_array[3*v + 0] = vertices[v].position[0];
@@ -70,7 +76,7 @@ protected:
             positions_array[3*v + 2] = vertices[v].position[2];
         }
     }
-    void build_normals_array() {
+    void build_normals_array() const {
         normalsArray.resize( 3 * vertices.size() );
         for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
             normalsArray[3*v + 0] = vertices[v].normal[0];
@@ -78,14 +84,14 @@ protected:
             normalsArray[3*v + 2] = vertices[v].normal[2];
         }
     }
-    void build_UVs_array() {
+    void build_UVs_array() const {
         uvs_array.resize( 2 * vertices.size() );
         for( unsigned int vert = 0 ; vert < vertices.size() ; ++vert ) {
             uvs_array[2*vert + 0] = vertices[vert].u;
             uvs_array[2*vert + 1] = vertices[vert].v;
         }
     }
-    void build_triangles_array() {
+    void build_triangles_array() const {
         triangles_array.resize( 3 * triangles.size() );
         for( unsigned int t = 0 ; t < triangles.size() ; ++t ) {
             triangles_array[3*t + 0] = triangles[t].v[0];
@@ -93,47 +99,106 @@ protected:
             triangles_array[3*t + 2] = triangles[t].v[2];
         }
     }
+    // ray tracing data : the corners of every triangle side by side, and a BVH over the triangles
+    void build_bvh() {
+        triangle_vertices.resize( 3 * triangles.size() );
+        std::vector< BVHPrimitive > primitives( triangles.size() );
+        for( unsigned int t = 0 ; t < triangles.size() ; ++t ) {
+            AABB bounds;
+            for( unsigned int c = 0 ; c < 3 ; ++c ) {
+                triangle_vertices[3*t + c] = vertices[triangles[t].v[c]].position;
+                bounds.extend( triangle_vertices[3*t + c] );
+            }
+            primitives[t] = BVHPrimitive( bounds , 0 , t );
+        }
+        bvh.build( primitives );
+    }
+
+    std::vector< Vec3 > triangle_vertices;
+    BVH bvh;
+
+    // Transformations not applied to the vertices yet : x -> pending_transform * x + pending_translation.
+    // Each transformation call only composes this map (O(1) whatever the size of the mesh); build_arrays applies it
+    // to the vertices once.
+    Mat3 pending_transform;
+    Vec3 pending_translation;
+    bool transform_pending;
+    // vertices changed since the last build_arrays
+    bool arrays_dirty;
+    // vertices changed since the GL arrays were built
+    mutable bool gl_arrays_dirty;
+
+    void build_gl_arrays() const {
+        build_positions_array();
+        build_normals_array();
+        build_UVs_array();
+        build_triangles_array();
+        gl_arrays_dirty = false;
+    }
 public:
+    Mesh() : pending_transform( 1. , 0. , 0. , 0. , 1. , 0. , 0. , 0. , 1. ) , pending_translation( 0. , 0. , 0. ) ,
+             transform_pending( false ) , arrays_dirty( true ) , gl_arrays_dirty( true ) {}
+
     std::vector<MeshVertex> vertices;
     std::vector<MeshTriangle> triangles;
 
-    std::vector< float > positions_array;
-    std::vector< float > normalsArray;
-    std::vector< float > uvs_array;
-    std::vector< unsigned int > triangles_array;
+    // GL preview, built from the vertices by the first draw after build_arrays : offline renders never build it
+    mutable std::vector< float > positions_array;
+    mutable std::vector< float > normalsArray;
+    mutable std::vector< float > uvs_array;
+    mutable std::vector< unsigned int > triangles_array;
 
     Material material;
 
-    void loadOFF (const std::string & filename);
+    // Returns false, with a message, if the file could not be read (see Mesh.cpp for the formats)
+    bool loadOFF (const std::string & filename);
     void recomputeNormals ();
+    void recomputeTangents ();
     void centerAndScaleToUnit ();
     void scaleUnit ();
 
 
+    // Applies the pending transformations to the vertices
+    void bake_transform() {
+        if( !transform_pending ) return;
+        if( !vertices.empty() )
+            pending_transform.transformPoints( &vertices[0].position , vertices.size() , sizeof( MeshVertex ) , pending_translation );
+        pending_transform = Mat3( 1. , 0. , 0. , 0. , 1. , 0. , 0. , 0. , 1. );
+        pending_translation = Vec3( 0. , 0. , 0. );
+        transform_pending = false;
+    }
+
+    // To call after editing vertices directly : the next update_arrays rebuilds everything
+    void invalidate_arrays() { arrays_dirty = gl_arrays_dirty = true; }
+
+    // Builds the arrays if the vertices or the transformations changed since the last time (Scene::build_bvh does it
+    // for every mesh and square, before rendering and drawing)
+    void update_arrays() {
+        if( arrays_dirty || transform_pending ) build_arrays();
+    }
+
+    // Normals, tangents and BVH, from the vertices once the pending transformations are applied. The GL arrays are
+    // left to the next draw.
     virtual
     void build_arrays() {
+        bake_transform();
+        arrays_dirty = false;
+        gl_arrays_dirty = true;
         recomputeNormals();
-        build_positions_array();
-        build_normals_array();
-        build_UVs_array();
-        build_triangles_array();
+        recomputeTangents();
+        build_bvh();
     }
 
 
     void translate( Vec3 const & translation ){
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            vertices[v].position += translation;
-        }
-
-        build_arrays();
+        pending_translation += translation;
+        transform_pending = true;
     }
 
     void apply_transformation_matrix( Mat3 transform ){
-        for( unsigned int v = 0 ; v < vertices.size() ; ++v ) {
-            vertices[v].position = transform*vertices[v].position;
-        }
-
-        build_arrays();
+        pending_transform = transform*pending_transform;
+        pending_translation = transform*pending_translation;
+        transform_pending = true;
     }
 
     void scale( Vec3 const & scale ){
@@ -169,6 +234,12 @@ public:
 
 
     void draw() const {
+        draw( material );
+    }
+
+    // Draws the mesh with the given material (see Sphere::draw, whose preview is a shared mesh)
+    void draw( Material const & material ) const {
+        if( gl_arrays_dirty ) build_gl_arrays();
         if( triangles_array.size() == 0 ) return;
         GLfloat material_color[4] = {material.color[0],
                                      material.color[1],
@@ -198,16 +269,95 @@ public:
 
     }
 
+    // Closest triangle hit in [ray.tMin(), min( ray.tMax(), tMax )[ : distance, triangle and barycentric coordinates of its
+    // 2nd and 3rd corners. A caller that found a hit already passes its distance as tMax, so that the traversal prunes.
+    // The hit point, normal and uv are left to surface().
+    bool hit( Ray const & ray , float & t , unsigned int & triangle , float & b1 , float & b2 , float tMax = FLT_MAX ) const {
+        // watertight test : no ray slips through the shared edges of two triangles
+        WatertightRay watertightRay( ray );
+        bool found = false;
+        float tMin = std::max( ray.tMin() , 0.0001f );
+        tMax = std::min( tMax , ray.tMax() );
+        bvh.traverse( ray , tMax , [&]( unsigned int , unsigned int tri , float & tClosest ) {
+            float tHit , w0 , w1 , w2;
+            if( !intersect_triangle_watertight( watertightRay , triangle_vertices[3*tri] , triangle_vertices[3*tri + 1] , triangle_vertices[3*tri + 2] ,
+                                                tMin , tClosest , tHit , w0 , w1 , w2 ) )
+                return;
+            tClosest = tHit;
+            found = true;
+            triangle = tri;
+            b1 = w1;
+            b2 = w2;
+        } );
+        t = tMax;
+        return found;
+    }
+
+    // shading normal and uv interpolated from the corners of the triangle
+    void surface( unsigned int triangle , float b1 , float b2 , Vec3 & normal , float & u , float & v ) const {
+        MeshVertex const & v0 = vertices[triangles[triangle].v[0]];
+        MeshVertex const & v1 = vertices[triangles[triangle].v[1]];
+        MeshVertex const & v2 = vertices[triangles[triangle].v[2]];
+        float b0 = 1.f - b1 - b2;
+        normal = b0 * v0.normal + b1 * v1.normal + b2 * v2.normal;
+        normal.normalize();
+        u = b0 * v0.u + b1 * v1.u + b2 * v2.u;
+        v = b0 * v0.v + b1 * v1.v + b2 * v2.v;
+    }
+
+    // tangent frame interpolated from the corners of the triangle, made orthogonal to the shading normal
+    void tangentFrame( unsigned int triangle , float b1 , float b2 , Vec3 const & normal , Vec3 & tangent , float & handedness ) const {
+        MeshVertex const & v0 = vertices[triangles[triangle].v[0]];
+        MeshVertex const & v1 = vertices[triangles[triangle].v[1]];
+        MeshVertex const & v2 = vertices[triangles[triangle].v[2]];
+        float b0 = 1.f - b1 - b2;
+        tangent = b0 * v0.tangent + b1 * v1.tangent + b2 * v2.tangent;
+        tangent = tangent - Vec3::dot( tangent , normal ) * normal;
+        if( tangent.squareLength() < 1e-12f ) tangent = normal.getOrthogonal();
+        tangent.normalize();
+        handedness = v0.handedness;
+    }
+
+    // units of texture coordinates per unit of length on the triangle (square root of the ratio of the areas)
+    float uvDensity( unsigned int triangle ) const {
+        MeshVertex const & v0 = vertices[triangles[triangle].v[0]];
+        MeshVertex const & v1 = vertices[triangles[triangle].v[1]];
+        MeshVertex const & v2 = vertices[triangles[triangle].v[2]];
+        float uvArea = fabs( ( v1.u - v0.u ) * ( v2.v - v0.v ) - ( v2.u - v0.u ) * ( v1.v - v0.v ) );
+        float area = Vec3::cross( v1.position - v0.position , v2.position - v0.position ).length();
+        return area > 0.f ? sqrtf( uvArea / area ) : 0.f;
+    }
+
     RayTriangleIntersection intersect( Ray const & ray ) const {
         RayTriangleIntersection closestIntersection;
         closestIntersection.t = FLT_MAX;
         closestIntersection.intersectionExists = false;
-        // Note :
-        // Creer un objet Triangle pour chaque face
-        // Vous constaterez des problemes de précision
-        // solution : ajouter un facteur d'échelle lors de la création du Triangle : float triangleScaling = 1.000001;
+
+        float t , b1 , b2;
+        unsigned int triangle;
+        if( !hit( ray , t , triangle , b1 , b2 ) ) return closestIntersection;
+
+        closestIntersection.intersectionExists = true;
+        closestIntersection.t = t;
+        closestIntersection.tIndex = triangle;
+        closestIntersection.w0 = 1.f - b1 - b2;
+        closestIntersection.w1 = b1;
+        closestIntersection.w2 = b2;
+        closestIntersection.intersection = ray.origin() + t * ray.direction();
+        surface( triangle , b1 , b2 , closestIntersection.normal , closestIntersection.u , closestIntersection.v );
         return closestIntersection;
     }
+
+    // any-hit test for shadow rays : stops at the first triangle in [tMin, tMax[
+    bool intersects( Ray const & ray , float tMin , float tMax ) const {
+        WatertightRay watertightRay( ray );
+        tMin = std::max( tMin , 0.0001f );
+        return bvh.traverseAny( ray , tMax , [&]( unsigned int , unsigned int t ) {
+            float tHit , b0 , b1 , b2;
+            return intersect_triangle_watertight( watertightRay , triangle_vertices[3*t] , triangle_vertices[3*t + 1] , triangle_vertices[3*t + 2] ,
+                                                  tMin , tMax , tHit , b0 , b1 , b2 );
+        } );
+    }
 };
 
 
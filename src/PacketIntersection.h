@@ -0,0 +1,82 @@
+#ifndef PACKETINTERSECTION_H
+#define PACKETINTERSECTION_H
+
+#include <cfloat>
+#include "RayPacket.h"
+#include "Sphere.h"
+#include "Square.h"
+
+// -------------------------------------------
+// Closest hit kernels of the ray packets, one per primitive type.
+// -------------------------------------------
+
+// Packet / sphere : same algebra as Sphere::intersect, lanes with a closer hit are updated
+static inline void intersect_packet_sphere( RayPacket & packet , Sphere const & sphere , int type , int index ) {
+    using namespace simd;
+    if( !packet.coneMayHitSphere( sphere.m_center , sphere.m_radius ) ) return;
+    vfloat cx = set1( sphere.m_center[0] ) , cy = set1( sphere.m_center[1] ) , cz = set1( sphere.m_center[2] );
+    vfloat cc = set1( Vec3::dot( sphere.m_center , sphere.m_center ) ) , r2 = set1( sphere.m_radius * sphere.m_radius );
+    vfloat zero = set1( 0.f ) , infinity = set1( FLT_MAX );
+    vfloat typeLanes = set1( (float)type ) , indexLanes = set1( (float)index );
+    for( unsigned int i = 0 ; i < packet.paddedSize() ; i += SIMD_WIDTH ) {
+        vfloat ox = load( packet.ox + i ) , oy = load( packet.oy + i ) , oz = load( packet.oz + i );
+        vfloat dx = load( packet.dx + i ) , dy = load( packet.dy + i ) , dz = load( packet.dz + i );
+        vfloat a = dot( dx , dy , dz , dx , dy , dz );
+        vfloat b = mul( set1( 2.f ) , dot( dx , dy , dz , sub( ox , cx ) , sub( oy , cy ) , sub( oz , cz ) ) );
+        vfloat c = sub( sub( add( dot( ox , oy , oz , ox , oy , oz ) , cc ) , mul( set1( 2.f ) , dot( ox , oy , oz , cx , cy , cz ) ) ) , r2 );
+        vfloat discriminant = sub( mul( b , b ) , mul( set1( 4.f ) , mul( a , c ) ) );
+        vfloat valid = gt( discriminant , zero );
+        if( movemask( valid ) == 0 ) continue;
+        vfloat root = sqrt( select( valid , zero , discriminant ) );
+        vfloat twoA = mul( set1( 2.f ) , a );
+        vfloat t1 = div( sub( sub( zero , b ) , root ) , twoA );
+        vfloat t2 = div( add( sub( zero , b ) , root ) , twoA );
+        vfloat t = select( ge( t1 , zero ) , select( ge( t2 , zero ) , infinity , t2 ) , t1 );
+        vfloat tBest = load( packet.t + i );
+        vfloat closer = andMask( valid , lt( t , tBest ) );
+        if( movemask( closer ) == 0 ) continue;
+        store( packet.t + i , select( closer , tBest , t ) );
+        store( packet.type + i , select( closer , load( packet.type + i ) , typeLanes ) );
+        store( packet.index + i , select( closer , load( packet.index + i ) , indexLanes ) );
+    }
+}
+
+// Packet / quad : same tests as Square::intersect
+static inline void intersect_packet_square( RayPacket & packet , Square const & square , int type , int index ) {
+    using namespace simd;
+    Vec3 const & p0 = square.vertices[0].position;
+    Vec3 center = 0.5f * ( p0 + square.vertices[2].position );
+    if( !packet.coneMayHitSphere( center , ( square.vertices[2].position - center ).length() ) ) return;
+    Vec3 AB = square.vertices[1].position - p0 , AC = square.vertices[3].position - p0;
+    vfloat nx = set1( square.m_normal[0] ) , ny = set1( square.m_normal[1] ) , nz = set1( square.m_normal[2] );
+    vfloat px = set1( center[0] ) , py = set1( center[1] ) , pz = set1( center[2] );
+    vfloat ax = set1( p0[0] ) , ay = set1( p0[1] ) , az = set1( p0[2] );
+    vfloat abx = set1( AB[0] ) , aby = set1( AB[1] ) , abz = set1( AB[2] ) , ab2 = set1( Vec3::dot( AB , AB ) );
+    vfloat acx = set1( AC[0] ) , acy = set1( AC[1] ) , acz = set1( AC[2] ) , ac2 = set1( Vec3::dot( AC , AC ) );
+    vfloat zero = set1( 0.f );
+    vfloat typeLanes = set1( (float)type ) , indexLanes = set1( (float)index );
+    for( unsigned int i = 0 ; i < packet.paddedSize() ; i += SIMD_WIDTH ) {
+        vfloat ox = load( packet.ox + i ) , oy = load( packet.oy + i ) , oz = load( packet.oz + i );
+        vfloat dx = load( packet.dx + i ) , dy = load( packet.dy + i ) , dz = load( packet.dz + i );
+        vfloat denominator = dot( nx , ny , nz , dx , dy , dz );
+        vfloat valid = lt( denominator , set1( -0.0001f ) );
+        if( movemask( valid ) == 0 ) continue;
+        vfloat numerator = dot( sub( px , ox ) , sub( py , oy ) , sub( pz , oz ) , nx , ny , nz );
+        vfloat t = div( numerator , select( valid , set1( -1.f ) , denominator ) );
+        valid = andMask( valid , andMask( le( t , set1( 100000.f ) ) , ge( t , set1( 0.0001f ) ) ) );
+        vfloat mx = sub( add( ox , mul( t , dx ) ) , ax );
+        vfloat my = sub( add( oy , mul( t , dy ) ) , ay );
+        vfloat mz = sub( add( oz , mul( t , dz ) ) , az );
+        vfloat u = dot( abx , aby , abz , mx , my , mz );
+        vfloat v = dot( acx , acy , acz , mx , my , mz );
+        valid = andMask( valid , andMask( andMask( ge( u , zero ) , le( u , ab2 ) ) , andMask( ge( v , zero ) , le( v , ac2 ) ) ) );
+        vfloat tBest = load( packet.t + i );
+        vfloat closer = andMask( valid , lt( t , tBest ) );
+        if( movemask( closer ) == 0 ) continue;
+        store( packet.t + i , select( closer , tBest , t ) );
+        store( packet.type + i , select( closer , load( packet.type + i ) , typeLanes ) );
+        store( packet.index + i , select( closer , load( packet.index + i ) , indexLanes ) );
+    }
+}
+
+#endif // PACKETINTERSECTION_H
@@ -1,9 +1,17 @@
 #ifndef RAY_H
 #define RAY_H
+#include <cfloat>
 #include "Line.h"
+// The direction is unit length (see Line) : t is a distance along the ray.
+// Only hits with t in [tMin, tMax[ count.
 class Ray : public Line {
+private:
+    float m_tMin , m_tMax;
 public:
-    Ray() : Line() {}
-    Ray( Vec3 const & o , Vec3 const & d ) : Line(o,d) {}
+    Ray() : Line() , m_tMin(0.f) , m_tMax(FLT_MAX) {}
+    Ray( Vec3 const & o , Vec3 const & d , float tMin = 0.f , float tMax = FLT_MAX ) : Line(o,d) , m_tMin(tMin) , m_tMax(tMax) {}
+    float tMin() const { return m_tMin; }
+    float tMax() const { return m_tMax; }
+    void setInterval( float tMin , float tMax ) { m_tMin = tMin; m_tMax = tMax; }
 };
 #endif
@@ -0,0 +1,116 @@
+#ifndef RAYBINNING_H
+#define RAYBINNING_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Vec3.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "BVH.h"
+
+// -------------------------------------------
+// Reordering of incoherent rays before traversal.
+// A ray goes to the bin of the direction octant and of the cell of its origin in a BINNING_GRID^3 grid over the
+// scene bounds. Bins are ordered by octant, then by Morton order of the cells, so that neighbouring bins also
+// hold rays that traverse the same nodes. Consecutive rays of the order then form the packets of the extension.
+// -------------------------------------------
+
+static const unsigned int BINNING_GRID = 4;
+static const unsigned int BINNING_KEYS = 8 * BINNING_GRID * BINNING_GRID * BINNING_GRID;
+
+// Coherence of the traced rays, measured as the number of runs of rays of the same bin in a packet
+// (RAY_PACKET_SIZE consecutive rays) : the lower, the closer the rays of a packet are.
+struct RayBinningStatistics {
+    unsigned long long rays , sortedRays;
+    unsigned long long packets , binsBefore , binsAfter;
+
+    RayBinningStatistics() : rays( 0 ) , sortedRays( 0 ) , packets( 0 ) , binsBefore( 0 ) , binsAfter( 0 ) {}
+
+    void add( RayBinningStatistics const & other ) {
+        rays += other.rays;
+        sortedRays += other.sortedRays;
+        packets += other.packets;
+        binsBefore += other.binsBefore;
+        binsAfter += other.binsAfter;
+    }
+    float binsPerPacketBefore() const { return packets == 0 ? 0.f : (float)binsBefore / packets; }
+    float binsPerPacketAfter() const { return packets == 0 ? 0.f : (float)binsAfter / packets; }
+};
+
+class RayBinner {
+public:
+    // Fills order with the indices of rays grouped by bin.
+    // Returns false, leaving order untouched, if the rays are coherent already : a packet of consecutive rays
+    // then spans at most COHERENT_BINS bins on average and sorting would not pay for itself.
+    bool sort( std::vector< Ray > const & rays , AABB const & bounds , std::vector< unsigned int > & order ) {
+        unsigned int n = (unsigned int)rays.size();
+        if( n == 0 || bounds.empty() ) return false;
+        float scale[3];
+        for( int c = 0 ; c < 3 ; ++c ) {
+            float extent = bounds.bmax[c] - bounds.bmin[c];
+            scale[c] = extent > 0.f ? BINNING_GRID / extent : 0.f;
+        }
+        m_keys.resize( n );
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            Vec3 const & o = rays[i].origin();
+            Vec3 const & d = rays[i].direction();
+            unsigned int cell[3];
+            for( int c = 0 ; c < 3 ; ++c ) {
+                int k = (int)( ( o[c] - bounds.bmin[c] ) * scale[c] );
+                cell[c] = (unsigned int)std::max( 0 , std::min( k , (int)BINNING_GRID - 1 ) );
+            }
+            unsigned int octant = ( d[0] < 0.f ? 1 : 0 ) | ( d[1] < 0.f ? 2 : 0 ) | ( d[2] < 0.f ? 4 : 0 );
+            m_keys[i] = (unsigned short)( octant * BINNING_GRID * BINNING_GRID * BINNING_GRID + morton( cell[0] , cell[1] , cell[2] ) );
+        }
+
+        unsigned int packets = ( n + RAY_PACKET_SIZE - 1 ) / RAY_PACKET_SIZE;
+        unsigned long long binsBefore = binsPerPacket( m_keys , NULL , n );
+        statistics.rays += n;
+        statistics.packets += packets;
+        statistics.binsBefore += binsBefore;
+        if( binsBefore <= COHERENT_BINS * packets ) {
+            statistics.binsAfter += binsBefore;
+            return false;
+        }
+
+        // counting sort, stable : rays of a bin keep their order
+        m_counts.assign( BINNING_KEYS + 1 , 0 );
+        for( unsigned int i = 0 ; i < n ; ++i ) ++m_counts[m_keys[i] + 1];
+        for( unsigned int k = 1 ; k <= BINNING_KEYS ; ++k ) m_counts[k] += m_counts[k - 1];
+        order.resize( n );
+        for( unsigned int i = 0 ; i < n ; ++i ) order[m_counts[m_keys[i]]++] = i;
+
+        statistics.sortedRays += n;
+        statistics.binsAfter += binsPerPacket( m_keys , &order[0] , n );
+        return true;
+    }
+
+    RayBinningStatistics statistics;
+
+private:
+    static const unsigned int COHERENT_BINS = 2;
+
+    // interleaves the bits of 2 bit cell coordinates
+    static unsigned int morton( unsigned int x , unsigned int y , unsigned int z ) {
+        unsigned int code = 0;
+        for( unsigned int bit = 0 ; ( 1u << bit ) < BINNING_GRID ; ++bit )
+            code |= ( ( ( x >> bit ) & 1u ) << ( 3 * bit ) ) | ( ( ( y >> bit ) & 1u ) << ( 3 * bit + 1 ) ) | ( ( ( z >> bit ) & 1u ) << ( 3 * bit + 2 ) );
+        return code;
+    }
+
+    // sum over the packets of the number of key changes + 1, the rays being visited in order (or 0..n-1 if order is NULL)
+    static unsigned long long binsPerPacket( std::vector< unsigned short > const & keys , unsigned int const * order , unsigned int n ) {
+        unsigned long long bins = 0;
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            unsigned int key = keys[order ? order[i] : i];
+            if( i % RAY_PACKET_SIZE == 0 || key != keys[order ? order[i - 1] : i - 1] ) ++bins;
+        }
+        return bins;
+    }
+
+    std::vector< unsigned short > m_keys;
+    std::vector< unsigned int > m_counts;
+};
+
+#endif // RAYBINNING_H
@@ -0,0 +1,177 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "Vec3.h"
+#include "Ray.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// -------------------------------------------
+// SIMD ray packets.
+// A packet holds up to RAY_PACKET_SIZE rays in SoA layout. The kernels process it
+// SIMD_WIDTH lanes at a time : 8 with AVX, 4 with SSE2, 1 otherwise.
+// Packets are meant for coherent rays (primary rays of a pixel, shadow rays towards
+// one light); incoherent rays go through the single ray path.
+// -------------------------------------------
+
+namespace simd {
+
+#if defined(__AVX__)
+static const unsigned int SIMD_WIDTH = 8;
+typedef __m256 vfloat;
+static inline vfloat set1( float a ) { return _mm256_set1_ps( a ); }
+static inline vfloat load( float const * p ) { return _mm256_load_ps( p ); }
+static inline void store( float * p , vfloat a ) { _mm256_store_ps( p , a ); }
+static inline vfloat add( vfloat a , vfloat b ) { return _mm256_add_ps( a , b ); }
+static inline vfloat sub( vfloat a , vfloat b ) { return _mm256_sub_ps( a , b ); }
+static inline vfloat mul( vfloat a , vfloat b ) { return _mm256_mul_ps( a , b ); }
+static inline vfloat div( vfloat a , vfloat b ) { return _mm256_div_ps( a , b ); }
+static inline vfloat sqrt( vfloat a ) { return _mm256_sqrt_ps( a ); }
+static inline vfloat min( vfloat a , vfloat b ) { return _mm256_min_ps( a , b ); }
+static inline vfloat max( vfloat a , vfloat b ) { return _mm256_max_ps( a , b ); }
+static inline vfloat lt( vfloat a , vfloat b ) { return _mm256_cmp_ps( a , b , _CMP_LT_OQ ); }
+static inline vfloat le( vfloat a , vfloat b ) { return _mm256_cmp_ps( a , b , _CMP_LE_OQ ); }
+static inline vfloat gt( vfloat a , vfloat b ) { return _mm256_cmp_ps( a , b , _CMP_GT_OQ ); }
+static inline vfloat ge( vfloat a , vfloat b ) { return _mm256_cmp_ps( a , b , _CMP_GE_OQ ); }
+static inline vfloat andMask( vfloat a , vfloat b ) { return _mm256_and_ps( a , b ); }
+static inline vfloat orMask( vfloat a , vfloat b ) { return _mm256_or_ps( a , b ); }
+// mask ? b : a
+static inline vfloat select( vfloat mask , vfloat a , vfloat b ) { return _mm256_blendv_ps( a , b , mask ); }
+static inline int movemask( vfloat mask ) { return _mm256_movemask_ps( mask ); }
+#elif defined(__SSE2__)
+static const unsigned int SIMD_WIDTH = 4;
+typedef __m128 vfloat;
+static inline vfloat set1( float a ) { return _mm_set1_ps( a ); }
+static inline vfloat load( float const * p ) { return _mm_load_ps( p ); }
+static inline void store( float * p , vfloat a ) { _mm_store_ps( p , a ); }
+static inline vfloat add( vfloat a , vfloat b ) { return _mm_add_ps( a , b ); }
+static inline vfloat sub( vfloat a , vfloat b ) { return _mm_sub_ps( a , b ); }
+static inline vfloat mul( vfloat a , vfloat b ) { return _mm_mul_ps( a , b ); }
+static inline vfloat div( vfloat a , vfloat b ) { return _mm_div_ps( a , b ); }
+static inline vfloat sqrt( vfloat a ) { return _mm_sqrt_ps( a ); }
+static inline vfloat min( vfloat a , vfloat b ) { return _mm_min_ps( a , b ); }
+static inline vfloat max( vfloat a , vfloat b ) { return _mm_max_ps( a , b ); }
+static inline vfloat lt( vfloat a , vfloat b ) { return _mm_cmplt_ps( a , b ); }
+static inline vfloat le( vfloat a , vfloat b ) { return _mm_cmple_ps( a , b ); }
+static inline vfloat gt( vfloat a , vfloat b ) { return _mm_cmpgt_ps( a , b ); }
+static inline vfloat ge( vfloat a , vfloat b ) { return _mm_cmpge_ps( a , b ); }
+static inline vfloat andMask( vfloat a , vfloat b ) { return _mm_and_ps( a , b ); }
+static inline vfloat orMask( vfloat a , vfloat b ) { return _mm_or_ps( a , b ); }
+static inline vfloat select( vfloat mask , vfloat a , vfloat b ) { return _mm_or_ps( _mm_and_ps( mask , b ) , _mm_andnot_ps( mask , a ) ); }
+static inline int movemask( vfloat mask ) { return _mm_movemask_ps( mask ); }
+#else
+static const unsigned int SIMD_WIDTH = 1;
+// scalar fallback : a mask is 1.f (true) or 0.f (false)
+typedef float vfloat;
+static inline vfloat set1( float a ) { return a; }
+static inline vfloat load( float const * p ) { return *p; }
+static inline void store( float * p , vfloat a ) { *p = a; }
+static inline vfloat add( vfloat a , vfloat b ) { return a + b; }
+static inline vfloat sub( vfloat a , vfloat b ) { return a - b; }
+static inline vfloat mul( vfloat a , vfloat b ) { return a * b; }
+static inline vfloat div( vfloat a , vfloat b ) { return a / b; }
+static inline vfloat sqrt( vfloat a ) { return std::sqrt( a ); }
+static inline vfloat min( vfloat a , vfloat b ) { return a < b ? a : b; }
+static inline vfloat max( vfloat a , vfloat b ) { return a > b ? a : b; }
+static inline vfloat lt( vfloat a , vfloat b ) { return a < b ? 1.f : 0.f; }
+static inline vfloat le( vfloat a , vfloat b ) { return a <= b ? 1.f : 0.f; }
+static inline vfloat gt( vfloat a , vfloat b ) { return a > b ? 1.f : 0.f; }
+static inline vfloat ge( vfloat a , vfloat b ) { return a >= b ? 1.f : 0.f; }
+static inline vfloat andMask( vfloat a , vfloat b ) { return ( a != 0.f && b != 0.f ) ? 1.f : 0.f; }
+static inline vfloat orMask( vfloat a , vfloat b ) { return ( a != 0.f || b != 0.f ) ? 1.f : 0.f; }
+static inline vfloat select( vfloat mask , vfloat a , vfloat b ) { return mask != 0.f ? b : a; }
+static inline int movemask( vfloat mask ) { return mask != 0.f ? 1 : 0; }
+#endif
+
+static inline vfloat dot( vfloat ax , vfloat ay , vfloat az , vfloat bx , vfloat by , vfloat bz ) {
+    return add( add( mul( ax , bx ) , mul( ay , by ) ) , mul( az , bz ) );
+}
+
+}
+
+
+static const unsigned int RAY_PACKET_SIZE = 16;
+
+struct alignas( 32 ) RayPacket {
+    float ox[RAY_PACKET_SIZE] , oy[RAY_PACKET_SIZE] , oz[RAY_PACKET_SIZE];
+    float dx[RAY_PACKET_SIZE] , dy[RAY_PACKET_SIZE] , dz[RAY_PACKET_SIZE];
+    // closest hit so far : t (tMax of the ray if none), object type (see RaySceneIntersection) and index, -1 if none.
+    // type and index are small integers stored as floats so that the kernels can blend them like t.
+    float t[RAY_PACKET_SIZE];
+    float type[RAY_PACKET_SIZE];
+    float index[RAY_PACKET_SIZE];
+    unsigned int size;
+
+    // bounding cone of the rays, used to skip whole primitives for the packet
+    bool hasCone;
+    Vec3 coneApex , coneAxis;
+    float coneCos;
+
+    // the lanes are zeroed so that no kernel ever reads an unset float, whatever the size given to set
+    RayPacket() : ox() , oy() , oz() , dx() , dy() , dz() , t() , type() , index() , size( 0 ) , hasCone( false ) , coneCos( -1.f ) {}
+
+    // Rays are padded to a multiple of the SIMD width by repeating the last one.
+    // Only hits closer than the tMax of each ray are kept; tMin is taken as 0.
+    void set( Ray const * rays , unsigned int n ) {
+        size = n;
+        unsigned int padded = paddedSize();
+        for( unsigned int i = 0 ; i < padded ; ++i ) {
+            Ray const & ray = rays[i < n ? i : n - 1];
+            ox[i] = ray.origin()[0]; oy[i] = ray.origin()[1]; oz[i] = ray.origin()[2];
+            dx[i] = ray.direction()[0]; dy[i] = ray.direction()[1]; dz[i] = ray.direction()[2];
+            t[i] = ray.tMax();
+            type[i] = -1.f;
+            index[i] = -1.f;
+        }
+        hasCone = false;
+    }
+    bool allHit() const {
+        for( unsigned int i = 0 ; i < size ; ++i )
+            if( type[i] < 0.f ) return false;
+        return true;
+    }
+    unsigned int paddedSize() const { return ( ( size + simd::SIMD_WIDTH - 1 ) / simd::SIMD_WIDTH ) * simd::SIMD_WIDTH; }
+
+    // Bounding cone of the packet, for rays that all go through apex (a shared origin, or the shared target of shadow rays).
+    // directionSign is +1 if the rays leave the apex, -1 if they point at it and stop there.
+    void computeCone( Vec3 const & apex , float directionSign ) {
+        Vec3 axis( 0.f , 0.f , 0.f );
+        for( unsigned int i = 0 ; i < size ; ++i ) axis += Vec3( dx[i] , dy[i] , dz[i] );
+        axis *= directionSign;
+        float length = axis.length();
+        hasCone = false;
+        if( length < 1e-6f ) return;
+        axis /= length;
+        float minCos = 1.f;
+        for( unsigned int i = 0 ; i < size ; ++i )
+            minCos = std::min( minCos , directionSign * Vec3::dot( axis , Vec3( dx[i] , dy[i] , dz[i] ) ) );
+        // wider than a hemisphere : culling would not be worth it
+        if( minCos <= 0.f ) return;
+        hasCone = true;
+        coneApex = apex;
+        coneAxis = axis;
+        coneCos = std::max( 0.f , minCos - 1e-4f );
+    }
+
+    // false if the sphere is entirely outside the bounding cone, i.e. no ray of the packet can touch it
+    bool coneMayHitSphere( Vec3 const & center , float radius ) const {
+        if( !hasCone ) return true;
+        Vec3 v = center - coneApex;
+        float distance = v.length();
+        if( distance <= radius ) return true;
+        float cosAlpha = Vec3::dot( v , coneAxis ) / distance;
+        float alpha = acosf( std::max( -1.f , std::min( 1.f , cosAlpha ) ) );
+        float beta = asinf( radius / distance );
+        return alpha - beta <= acosf( coneCos );
+    }
+};
+
+
+#endif // RAYPACKET_H
@@ -0,0 +1,332 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+
+#include "Vec3.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "CameraRayGenerator.h"
+#include "Sampler.h"
+#include "Wavefront.h"
+
+// -------------------------------------------
+// Tiled ray tracing of the scene, on the CPU only.
+// -------------------------------------------
+
+static const int TILE_SIZE = 32;
+
+// Running estimate of one pixel : sum of its samples, and mean / variance of their luminance (Welford).
+struct PixelEstimate {
+    Vec3 sum;
+    unsigned int samples;
+    float mean , m2;
+
+    PixelEstimate() : samples( 0 ) , mean( 0.f ) , m2( 0.f ) {}
+
+    void add( Vec3 const & color ) {
+        sum += color;
+        ++samples;
+        float luminance = 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+        float delta = luminance - mean;
+        mean += delta / samples;
+        m2 += delta * ( luminance - mean );
+    }
+    Vec3 value() const { return samples == 0 ? Vec3( 0.f , 0.f , 0.f ) : sum / samples; }
+    // standard error of the mean luminance
+    float error() const { return samples < 2 ? FLT_MAX : sqrt( m2 / ( ( samples - 1 ) * (float)samples ) ); }
+};
+
+// Adaptive sampling : a pixel takes at least minSamples, then stops as soon as the standard error
+// of its mean luminance is below threshold (relative to the mean), or when it reaches maxSamples.
+// threshold <= 0 gives every pixel exactly maxSamples.
+// With packets, the minimum budget of a pixel is traced as SIMD ray packets (see Scene::rayTracePacket).
+// With wavefront, the samples of a tile are traced stage by stage over a queue of paths (see WavefrontTracer), and
+// with binning as well, its secondary rays are reordered by origin and direction before their traversal (see RayBinner).
+// maxDepth is the maximum number of vertices of a path.
+// With mipmaps, camera rays carry the cone of their pixel and textures are fetched from the level of its footprint;
+// without, every fetch reads the full resolution level.
+struct SamplingSettings {
+    unsigned int minSamples , maxSamples;
+    float threshold;
+    SamplerType sampler;
+    bool packets;
+    bool wavefront;
+    bool binning;
+    unsigned int maxDepth;
+    bool mipmaps;
+
+    SamplingSettings( unsigned int minS = 8 , unsigned int maxS = 128 , float t = 0.02f , SamplerType type = Sampler_Sobol ) :
+        minSamples( minS ) , maxSamples( maxS ) , threshold( t ) , sampler( type ) , packets( true ) , wavefront( true ) , binning( true ) , maxDepth( DEFAULT_MAX_DEPTH ) , mipmaps( true ) {}
+
+    bool converged( PixelEstimate const & pixel ) const {
+        if( pixel.samples >= maxSamples ) return true;
+        if( threshold <= 0.f || pixel.samples < minSamples ) return false;
+        // dark pixels are compared to an absolute floor, otherwise they would never converge
+        return pixel.error() <= threshold * std::max( pixel.mean , 0.05f );
+    }
+};
+
+// Render statistics over the whole image
+static inline void sampling_statistics( std::vector< PixelEstimate > const & estimates , float & averageSamples , unsigned int & maxSamplesTaken ) {
+    double total = 0.0;
+    maxSamplesTaken = 0;
+    for( unsigned int i = 0 ; i < estimates.size() ; ++i ) {
+        total += estimates[i].samples;
+        maxSamplesTaken = std::max( maxSamplesTaken , estimates[i].samples );
+    }
+    averageSamples = estimates.empty() ? 0.f : (float)( total / estimates.size() );
+}
+
+// Same as the per pixel loop of render_pass over the tile [x0,x1[ x [y0,y1[, traced by rounds : the first round queues
+// the minimum budget of every pixel, the next ones one more sample per pixel that has not converged yet.
+// Returns the number of samples traced.
+static unsigned long long render_tile_wavefront( Scene const & scene , CameraRayGenerator const & rayGenerator , int x0 , int y0 , int x1 , int y1 , int w , int h ,
+                                                 unsigned int seed , SamplingSettings const & sampling , unsigned int nSamples ,
+                                                 std::vector< PixelEstimate > & estimates , WavefrontTracer & tracer ) {
+    std::vector< unsigned int > targets , slotPixels;
+    std::vector< float > us , vs;
+    std::vector< Vec3 > directions;
+    std::vector< PixelSampler > samplers;
+    for( int y = y0 ; y < y1 ; y++ )
+        for( int x = x0 ; x < x1 ; x++ )
+            targets.push_back( std::min( estimates[x + y * w].samples + nSamples , sampling.maxSamples ) );
+    RayCone cone( 0.f , sampling.mipmaps ? rayGenerator.pixelSpread( h ) : 0.f );
+    unsigned long long taken = 0;
+    for( bool firstRound = true ; ; firstRound = false ) {
+        us.clear();
+        vs.clear();
+        slotPixels.clear();
+        samplers.clear();
+        unsigned int tilePixel = 0;
+        for( int y = y0 ; y < y1 ; y++ ) {
+            for( int x = x0 ; x < x1 ; x++ , tilePixel++ ) {
+                PixelEstimate const & pixel = estimates[x + y * w];
+                unsigned int target = targets[tilePixel] , count = 0;
+                if( firstRound && pixel.samples < sampling.minSamples )
+                    count = std::min( sampling.minSamples , target ) - pixel.samples;
+                else if( pixel.samples < target && !sampling.converged( pixel ) )
+                    count = 1;
+                PixelSampler sampler( sampling.sampler , seed , x , y , w );
+                for( unsigned int s = 0 ; s < count ; ++s ) {
+                    float jx , jy;
+                    sampler.startSample( pixel.samples + s );
+                    sampler.get2D( jx , jy );
+                    us.push_back( ( (float)( x ) + jx ) / w );
+                    vs.push_back( ( (float)( y ) + jy ) / h );
+                    samplers.push_back( sampler );
+                    slotPixels.push_back( x + y * w );
+                }
+            }
+        }
+        if( us.empty() ) break;
+        directions.resize( us.size() );
+        rayGenerator.generate( us.data() , vs.data() , (unsigned int)us.size() , directions.data() );
+        for( unsigned int i = 0 ; i < directions.size() ; ++i )
+            tracer.addCameraPath( Ray( rayGenerator.origin() , directions[i] ) , samplers[i] , cone );
+        tracer.trace( scene , sampling.maxDepth , sampling.packets , sampling.binning );
+        // slots of one pixel are in sample order
+        for( unsigned int i = 0 ; i < slotPixels.size() ; ++i )
+            estimates[slotPixels[i]].add( tracer.color( i ) );
+        taken += slotPixels.size();
+    }
+    return taken;
+}
+
+// Adds up to nSamples samples to every pixel of estimates (w*h) that has not converged yet.
+// The sample index of a pixel is its current sample count, so the result does not depend on how the samples are split into passes.
+// Returns false if *cancel was raised before the pass completed. samplesTaken is the number of samples traced by this pass.
+// The ray binning statistics of the pass are added to *binningStatistics if it is not NULL.
+bool render_pass( ThreadPool & pool , Scene & scene , CameraRayGenerator const & rayGenerator , int w , int h ,
+                  unsigned int seed , SamplingSettings const & sampling , unsigned int nSamples ,
+                  std::vector< PixelEstimate > & estimates , unsigned long long & samplesTaken , std::atomic< bool > const * cancel = NULL ,
+                  RayBinningStatistics * binningStatistics = NULL ) {
+    unsigned int tilesX = ( w + TILE_SIZE - 1 ) / TILE_SIZE , tilesY = ( h + TILE_SIZE - 1 ) / TILE_SIZE;
+    std::atomic< unsigned long long > taken( 0 );
+    std::vector< WavefrontTracer > tracers( sampling.wavefront ? pool.size() : 0 );
+    RayCone cone( 0.f , sampling.mipmaps ? rayGenerator.pixelSpread( h ) : 0.f );
+    pool.parallel_for( tilesX * tilesY , [&]( unsigned int tile , unsigned int worker ) {
+        if( cancel != NULL && cancel->load() ) return;
+        int x0 = ( tile % tilesX ) * TILE_SIZE , y0 = ( tile / tilesX ) * TILE_SIZE;
+        int x1 = std::min< int >( x0 + TILE_SIZE , w ) , y1 = std::min< int >( y0 + TILE_SIZE , h );
+        if( sampling.wavefront ) {
+            taken += render_tile_wavefront( scene , rayGenerator , x0 , y0 , x1 , y1 , w , h , seed , sampling , nSamples , estimates , tracers[worker] );
+            return;
+        }
+        std::vector< float > us( sampling.minSamples ) , vs( sampling.minSamples );
+        std::vector< Vec3 > directions( sampling.minSamples ) , colors( RAY_PACKET_SIZE );
+        // one sampler per sample of the batch : the paths of a packet go on with their own sample dimensions
+        std::vector< PixelSampler > batchSamplers;
+        unsigned long long tileTaken = 0;
+        // tiles do not overlap : no lock on the estimates
+        for( int y = y0 ; y < y1 ; y++ ) {
+            for( int x = x0 ; x < x1 ; x++ ) {
+                PixelEstimate & pixel = estimates[x + y * w];
+                PixelSampler sampler( sampling.sampler , seed , x , y , w );
+                unsigned int target = std::min( pixel.samples + nSamples , sampling.maxSamples );
+                // the minimum budget does not need convergence tests : its rays are generated as one batch
+                unsigned int batch = 0;
+                if( pixel.samples < sampling.minSamples )
+                    batch = std::min( sampling.minSamples , target ) - pixel.samples;
+                batchSamplers.assign( batch , sampler );
+                for( unsigned int s = 0 ; s < batch ; ++s ) {
+                    // this is a random uv that belongs to the pixel xy.
+                    float jx , jy;
+                    batchSamplers[s].startSample( pixel.samples + s );
+                    batchSamplers[s].get2D( jx , jy );
+                    us[s] = ( (float)( x ) + jx ) / w;
+                    vs[s] = ( (float)( y ) + jy ) / h;
+                }
+                rayGenerator.generate( us.data() , vs.data() , batch , directions.data() );
+                if( sampling.packets ) {
+                    for( unsigned int s = 0 ; s < batch ; s += RAY_PACKET_SIZE ) {
+                        unsigned int n = std::min( batch - s , RAY_PACKET_SIZE );
+                        scene.rayTracePacket( rayGenerator.origin() , directions.data() + s , n , batchSamplers.data() + s , sampling.maxDepth , cone , colors.data() );
+                        for( unsigned int i = 0 ; i < n ; ++i )
+                            pixel.add( colors[i] );
+                    }
+                } else {
+                    for( unsigned int s = 0 ; s < batch ; ++s )
+                        pixel.add( scene.rayTrace( Ray( rayGenerator.origin() , directions[s] ) , batchSamplers[s] , sampling.maxDepth , cone ) );
+                }
+                tileTaken += batch;
+                while( pixel.samples < target && !sampling.converged( pixel ) ) {
+                    float jx , jy;
+                    sampler.startSample( pixel.samples );
+                    sampler.get2D( jx , jy );
+                    float u = ( (float)( x ) + jx ) / w;
+                    float v = ( (float)( y ) + jy ) / h;
+                    pixel.add( scene.rayTrace( Ray( rayGenerator.origin() , rayGenerator.direction( u , v ) ) , sampler , sampling.maxDepth , cone ) );
+                    ++tileTaken;
+                }
+            }
+        }
+        taken += tileTaken;
+    } );
+    samplesTaken = taken;
+    if( binningStatistics != NULL )
+        for( unsigned int i = 0 ; i < tracers.size() ; ++i )
+            binningStatistics->add( tracers[i].binningStatistics() );
+    return cancel == NULL || !cancel->load();
+}
+
+// Renders the image in one go, blocking.
+void render_image( ThreadPool & pool , Scene & scene , CameraMatrices const & matrices , int w , int h ,
+                   unsigned int seed , SamplingSettings const & sampling , std::vector< Vec3 > & image ) {
+    std::cout << "Ray tracing a " << w << " x " << h << " image on " << pool.size() << " thread(s)" << std::endl;
+    std::vector< PixelEstimate > estimates( w * h );
+    // camera matrices are inverted once for the whole frame
+    CameraRayGenerator rayGenerator( matrices );
+    unsigned long long samplesTaken;
+    RayBinningStatistics binning;
+    render_pass( pool , scene , rayGenerator , w , h , seed , sampling , sampling.maxSamples , estimates , samplesTaken , NULL , &binning );
+    image.resize( w * h );
+    for( int i = 0 ; i < w * h ; i++ )
+        image[i] = estimates[i].value();
+    float averageSamples;
+    unsigned int maxSamplesTaken;
+    sampling_statistics( estimates , averageSamples , maxSamplesTaken );
+    std::cout << "\tDone : " << averageSamples << " samples per pixel on average (max " << maxSamplesTaken << ")" << std::endl;
+    if( binning.rays > 0 )
+        std::cout << "\tRay binning : " << binning.sortedRays << " of " << binning.rays << " secondary rays reordered, "
+                  << binning.binsPerPacketBefore() << " -> " << binning.binsPerPacketAfter() << " bins per packet" << std::endl;
+    size_t textureBytes , uncompressedBytes;
+    double fetchCost;
+    if( scene.textureStatistics( textureBytes , uncompressedBytes , fetchCost ) > 0 )
+        std::cout << "\tTextures : " << textureBytes / 1024 << " KB (" << uncompressedBytes / 1024 << " KB uncompressed), "
+                  << fetchCost << " ns per filtered fetch" << std::endl;
+}
+
+
+// -------------------------------------------
+// Background render, refined pass by pass.
+// Each pass adds samplesPerPass samples to every pixel that has not converged yet. Once a pass is complete,
+// the running average is published for display (see fetch). cancel() stops the
+// job within one tile per thread.
+// -------------------------------------------
+
+class ProgressiveRender {
+public:
+    ProgressiveRender() : cancelled( false ) , running( false ) , width( 0 ) , height( 0 ) , publishedSamples( 0 ) , publishedPasses( 0 ) , fetchedPasses( 0 ) {}
+    ~ProgressiveRender() { cancel(); }
+
+    // onComplete( image , w , h , averageSamples ) is called from the render thread once every pixel has converged
+    void start( ThreadPool & pool , Scene & scene , CameraMatrices const & matrices , int w , int h ,
+                unsigned int seed , SamplingSettings const & sampling , unsigned int samplesPerPass ,
+                std::function< void( std::vector< Vec3 > const & , int , int , float ) > const & onComplete ) {
+        cancel();
+        width = w;
+        height = h;
+        publishedSamples = 0.f;
+        publishedPasses = fetchedPasses = 0;
+        cancelled = false;
+        running = true;
+        CameraRayGenerator rayGenerator( matrices );
+        job = std::thread( &ProgressiveRender::run , this , &pool , &scene , rayGenerator , seed , sampling ,
+                           std::max( 1u , samplesPerPass ) , onComplete );
+    }
+
+    void cancel() {
+        cancelled = true;
+        if( job.joinable() ) job.join();
+        running = false;
+    }
+
+    bool isRunning() const { return running; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // Copies the latest complete pass into image, if it was not fetched yet.
+    // Returns its average number of samples per pixel, 0 if nothing new.
+    float fetch( std::vector< Vec3 > & image ) {
+        std::unique_lock< std::mutex > guard( displayLock );
+        if( publishedPasses == fetchedPasses ) return 0.f;
+        fetchedPasses = publishedPasses;
+        image = displayImage;
+        return publishedSamples;
+    }
+
+private:
+    void run( ThreadPool * pool , Scene * scene , CameraRayGenerator rayGenerator , unsigned int seed , SamplingSettings sampling ,
+              unsigned int samplesPerPass , std::function< void( std::vector< Vec3 > const & , int , int , float ) > onComplete ) {
+        std::vector< PixelEstimate > estimates( width * height );
+        std::vector< Vec3 > average( width * height );
+        float averageSamples = 0.f;
+        unsigned int maxSamplesTaken;
+        while( true ) {
+            unsigned long long samplesTaken;
+            if( !render_pass( *pool , *scene , rayGenerator , width , height , seed , sampling , samplesPerPass , estimates , samplesTaken , &cancelled ) )
+                return;
+            // every pixel has converged
+            if( samplesTaken == 0 ) break;
+            for( int i = 0 ; i < width * height ; i++ )
+                average[i] = estimates[i].value();
+            sampling_statistics( estimates , averageSamples , maxSamplesTaken );
+            std::unique_lock< std::mutex > guard( displayLock );
+            displayImage = average;
+            publishedSamples = averageSamples;
+            ++publishedPasses;
+        }
+        running = false;
+        onComplete( average , width , height , averageSamples );
+    }
+
+    std::thread job;
+    std::atomic< bool > cancelled;
+    std::atomic< bool > running;
+    int width , height;
+
+    std::mutex displayLock;
+    std::vector< Vec3 > displayImage;
+    float publishedSamples;
+    unsigned int publishedPasses , fetchedPasses;
+};
+
+#endif // RENDERER_H
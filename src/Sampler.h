@@ -0,0 +1,223 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <array>
+#include <string>
+
+// -------------------------------------------
+// Sample generation.
+// Every value only depends on (seed, pixel, sample index, dimension): nothing is shared
+// between threads, and the image is bitwise identical whatever the thread count or the
+// order in which pixels and samples are rendered.
+// -------------------------------------------
+
+enum SamplerType {
+    Sampler_Random ,    // PCG32, one stream per pixel
+    Sampler_Sobol ,     // Owen-scrambled, shuffled Sobol (0,2)-sequence, padded per dimension pair
+    Sampler_Halton ,    // Halton sequence, one pair of prime bases per dimension pair, Owen scrambled per pixel and dimension pair
+    Sampler_BlueNoise   // Sobol (0,2)-sequence shuffled per dimension pair, rotated per pixel by an R2 dither mask : the error is spread as blue noise in screen space
+};
+
+static inline bool parse_sampler_type( std::string const & name , SamplerType & type ) {
+    if( name == "random" ) type = Sampler_Random;
+    else if( name == "sobol" ) type = Sampler_Sobol;
+    else if( name == "halton" ) type = Sampler_Halton;
+    else if( name == "bluenoise" ) type = Sampler_BlueNoise;
+    else return false;
+    return true;
+}
+
+// PCG32 (O'Neill 2014) : 64 bit state, 32 bit output, 2^63 selectable streams
+struct PCG32 {
+    uint64_t state , inc;
+
+    PCG32( uint64_t initState = 0x853c49e6748fea9bULL , uint64_t initSequence = 0xda3e39cb94b95bdbULL ) { seed( initState , initSequence ); }
+
+    void seed( uint64_t initState , uint64_t initSequence ) {
+        state = 0u;
+        inc = ( initSequence << 1u ) | 1u;
+        next();
+        state += initState;
+        next();
+    }
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorShifted = (uint32_t)( ( ( old >> 18u ) ^ old ) >> 27u );
+        uint32_t rot = (uint32_t)( old >> 59u );
+        return ( xorShifted >> rot ) | ( xorShifted << ( ( -rot ) & 31 ) );
+    }
+    // uniform in [0,1)
+    float nextFloat() { return ( next() >> 8 ) * 0x1p-24f; }
+};
+
+namespace sampling {
+
+static inline uint32_t hash( uint32_t x ) {
+    // lowbias32 (C. Wellons)
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+static inline uint32_t hash( uint32_t a , uint32_t b ) { return hash( a ^ hash( b + 0x9e3779b9U ) ); }
+static inline uint32_t hash( uint32_t a , uint32_t b , uint32_t c ) { return hash( a ^ hash( b , c ) ); }
+
+static inline uint32_t reverse_bits( uint32_t x ) {
+    x = ( x << 16 ) | ( x >> 16 );
+    x = ( ( x & 0x00ff00ffU ) << 8 ) | ( ( x & 0xff00ff00U ) >> 8 );
+    x = ( ( x & 0x0f0f0f0fU ) << 4 ) | ( ( x & 0xf0f0f0f0U ) >> 4 );
+    x = ( ( x & 0x33333333U ) << 2 ) | ( ( x & 0xccccccccU ) >> 2 );
+    x = ( ( x & 0x55555555U ) << 1 ) | ( ( x & 0xaaaaaaaaU ) >> 1 );
+    return x;
+}
+
+// Owen scrambling in base 2 (Laine-Karras permutation, Burley 2020)
+static inline uint32_t nested_uniform_scramble( uint32_t x , uint32_t seed ) {
+    x = reverse_bits( x );
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits( x );
+}
+
+static inline float to_unit_float( uint32_t x ) { return ( x >> 8 ) * 0x1p-24f; }
+
+static inline float fract( float x ) { return x - (float)(int)x; }
+
+// Direction numbers of the second Sobol dimension (primitive polynomial x + 1), built at compile time.
+// The first dimension is the van der Corput sequence, i.e. the bit reversal of the index.
+constexpr std::array< uint32_t , 32 > sobol_directions_dim1() {
+    std::array< uint32_t , 32 > v {};
+    v[0] = 1U << 31;
+    for( int i = 1 ; i < 32 ; ++i )
+        v[i] = v[i - 1] ^ ( v[i - 1] >> 1 );
+    return v;
+}
+static constexpr std::array< uint32_t , 32 > SOBOL_DIM1 = sobol_directions_dim1();
+
+static inline void sobol2d( uint32_t index , uint32_t & x , uint32_t & y ) {
+    x = reverse_bits( index );
+    y = 0;
+    for( int bit = 0 ; index != 0 ; index >>= 1 , ++bit )
+        if( index & 1 ) y ^= SOBOL_DIM1[bit];
+}
+
+// The first HALTON_PRIMES primes, built at compile time : dimension pair k of the Halton sampler uses the bases
+// 2k-th and (2k+1)-th primes
+static constexpr unsigned int HALTON_PRIMES = 256;
+constexpr std::array< uint32_t , HALTON_PRIMES > halton_primes() {
+    std::array< uint32_t , HALTON_PRIMES > primes {};
+    unsigned int count = 0;
+    for( uint32_t n = 2 ; count < HALTON_PRIMES ; ++n ) {
+        bool prime = true;
+        for( unsigned int i = 0 ; i < count && primes[i] * primes[i] <= n ; ++i )
+            if( n % primes[i] == 0 ) prime = false;
+        if( prime ) primes[count++] = n;
+    }
+    return primes;
+}
+static constexpr std::array< uint32_t , HALTON_PRIMES > HALTON_PRIME_BASES = halton_primes();
+
+// Owen scrambled radical inverse in a prime base b. Every digit goes through a random affine permutation
+// x -> (a x + c) mod b, picked by the scramble seed and by the digits of lower weight in the index : the first b^k
+// indices still fall in the b^k strata of [0,1). Digits are scrambled as long as b^k < 2^16 (more samples than a
+// pixel takes), the point is then placed at random inside its stratum.
+static inline float scrambled_radical_inverse( uint32_t base , uint32_t index , uint32_t seed ) {
+    uint32_t reversed = 0 , weight = 1 , prefix = 0 , tailSeed = hash( seed , index );
+    for( uint32_t d = 0 ; weight < ( 1u << 16 ) ; ++d ) {
+        uint32_t digit = index % base;
+        uint32_t h = hash( seed + prefix * 0x9e3779b9U + d * 0x85ebca6bU );
+        reversed = reversed * base + ( ( 1 + h % ( base - 1 ) ) * digit + ( h >> 16 ) ) % base;
+        prefix = prefix * base + digit;
+        index /= base;
+        weight *= base;
+    }
+    float result = (float)( ( reversed + to_unit_float( tailSeed ) ) / (double)weight );
+    return result < 1.f ? result : 0x1.fffffep-1f;
+}
+
+}
+
+// Samples of one pixel. Usage : startSample( s ) then get2D / get1D for each dimension the integrator consumes.
+class PixelSampler {
+public:
+    PixelSampler( SamplerType type , uint32_t seed , unsigned int x , unsigned int y , unsigned int w )
+        : m_type( type ) , m_x( x ) , m_y( y ) , m_seed( seed ) , m_pixelSeed( sampling::hash( seed , x + y * w ) ) , m_sample( 0 ) , m_dimension( 0 ) {}
+
+    void startSample( uint32_t sample ) {
+        m_sample = sample;
+        m_dimension = 0;
+        if( m_type == Sampler_Random )
+            m_rng.seed( ( (uint64_t)m_pixelSeed << 32 ) | sample , m_pixelSeed );
+    }
+
+    void get2D( float & u , float & v ) {
+        uint32_t dimensionSeed = sampling::hash( m_pixelSeed , m_dimension );
+        m_dimension += 2;
+        switch( m_type ) {
+        case Sampler_Random:
+        default:
+            u = m_rng.nextFloat();
+            v = m_rng.nextFloat();
+            return;
+        case Sampler_Sobol: {
+            // the shuffled index decorrelates the dimension pairs from one another
+            uint32_t index = sampling::nested_uniform_scramble( m_sample , dimensionSeed );
+            uint32_t x , y;
+            sampling::sobol2d( index , x , y );
+            u = sampling::to_unit_float( sampling::nested_uniform_scramble( x , sampling::hash( dimensionSeed , 1 ) ) );
+            v = sampling::to_unit_float( sampling::nested_uniform_scramble( y , sampling::hash( dimensionSeed , 2 ) ) );
+            return;
+        }
+        case Sampler_Halton: {
+            // one pair of prime bases per dimension pair, so that the pairs are decorrelated while every coordinate
+            // keeps the stratification of its base b over the first b^k samples. Past the table, plain random numbers.
+            unsigned int pair = m_dimension / 2 - 1;
+            if( 2 * pair + 1 >= sampling::HALTON_PRIMES ) {
+                u = sampling::to_unit_float( sampling::hash( dimensionSeed , m_sample , 1 ) );
+                v = sampling::to_unit_float( sampling::hash( dimensionSeed , m_sample , 2 ) );
+                return;
+            }
+            if( pair == 0 )
+                u = sampling::to_unit_float( sampling::nested_uniform_scramble( sampling::reverse_bits( m_sample ) , sampling::hash( dimensionSeed , 1 ) ) );
+            else
+                u = sampling::scrambled_radical_inverse( sampling::HALTON_PRIME_BASES[2 * pair] , m_sample , sampling::hash( dimensionSeed , 1 ) );
+            v = sampling::scrambled_radical_inverse( sampling::HALTON_PRIME_BASES[2 * pair + 1] , m_sample , sampling::hash( dimensionSeed , 2 ) );
+            return;
+        }
+        case Sampler_BlueNoise: {
+            // R2 sequence over the pixel grid (Roberts 2018) : neighbouring pixels get well spread shifts
+            float mask = sampling::fract( 0.5f + m_x * 0.7548776662f + m_y * 0.5698402910f );
+            // shuffle and shift shared by every pixel, so that the mask alone tells neighbours apart
+            uint32_t patternSeed = sampling::hash( m_seed , m_dimension , 0x2545f491U );
+            uint32_t x , y;
+            sampling::sobol2d( sampling::nested_uniform_scramble( m_sample , patternSeed ) , x , y );
+            float shift = sampling::to_unit_float( sampling::hash( patternSeed ) );
+            u = sampling::fract( sampling::to_unit_float( x ) + mask + shift );
+            v = sampling::fract( sampling::to_unit_float( y ) + sampling::fract( mask * 1.6180339887f + shift ) );
+            return;
+        }
+        }
+    }
+
+    float get1D() {
+        float u , v;
+        get2D( u , v );
+        return u;
+    }
+
+private:
+    SamplerType m_type;
+    unsigned int m_x , m_y;
+    uint32_t m_seed;
+    uint32_t m_pixelSeed;
+    uint32_t m_sample;
+    uint32_t m_dimension;
+    PCG32 m_rng;
+};
+
+#endif // SAMPLER_H
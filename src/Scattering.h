@@ -0,0 +1,49 @@
+#ifndef SCATTERING_H
+#define SCATTERING_H
+
+#include <cmath>
+#include <algorithm>
+#include "Vec3.h"
+
+// -------------------------------------------
+// Scattering directions of the path tracer.
+// Directions are unit vectors; d is the direction of the incoming ray and n the unit normal on its side (dot( d , n ) <= 0).
+// -------------------------------------------
+
+static inline Vec3 reflect( Vec3 const & d , Vec3 const & n ) {
+    return d - 2.f * Vec3::dot( d , n ) * n;
+}
+
+// Snell's law, eta = etaI / etaT. cosI = -dot( d , n ) and cosT the cosine of the refracted direction with -n.
+static inline Vec3 refract( Vec3 const & d , Vec3 const & n , float eta , float cosI , float cosT ) {
+    return eta * d + ( eta * cosI - cosT ) * n;
+}
+
+// Fresnel reflectance of an unpolarized ray crossing the interface from etaI to etaT, 1 on total internal reflection.
+// cosT is set to the cosine of the refracted direction.
+static inline float fresnel_dielectric( float cosI , float etaI , float etaT , float & cosT ) {
+    float eta = etaI / etaT;
+    float sin2T = eta * eta * std::max( 0.f , 1.f - cosI * cosI );
+    if( sin2T >= 1.f ) {
+        cosT = 0.f;
+        return 1.f;
+    }
+    cosT = sqrtf( 1.f - sin2T );
+    float rs = ( etaI * cosI - etaT * cosT ) / ( etaI * cosI + etaT * cosT );
+    float rp = ( etaT * cosI - etaI * cosT ) / ( etaT * cosI + etaI * cosT );
+    return 0.5f * ( rs * rs + rp * rp );
+}
+
+// Cosine distributed direction around n from ( u1 , u2 ) in [0,1)^2 (Malley : uniform disk sample projected on the hemisphere)
+static inline Vec3 sample_cosine_hemisphere( Vec3 const & n , float u1 , float u2 ) {
+    Vec3 tangent = n.getOrthogonal();
+    tangent.normalize();
+    Vec3 bitangent = Vec3::cross( n , tangent );
+    float r = sqrtf( u1 );
+    float phi = 2.f * (float)M_PI * u2;
+    float x = r * cosf( phi ) , y = r * sinf( phi );
+    float z = sqrtf( std::max( 0.f , 1.f - u1 ) );
+    return x * tangent + y * bitangent + z * n;
+}
+
+#endif // SCATTERING_H
@@ -6,6 +6,12 @@
 #include "Mesh.h"
 #include "Sphere.h"
 #include "Square.h"
+#include "PacketIntersection.h"
+#include "BVH.h"
+#include "Scattering.h"
+#include "Sampler.h"
+#include "LightBVH.h"
+#include "Texture.h"
 
 #include <GL/glut.h>
 
@@ -13,6 +19,20 @@ Vec3 i_ambient = Vec3(0.1f, 0.1f, 0.1f);
 Vec3 i_diffuse = Vec3(0.7f, 0.7f, 0.7f);
 Vec3 i_specular = Vec3(0.5f, 0.5f, 0.5f);
 
+// Path length : at most DEFAULT_MAX_DEPTH vertices unless the renderer asks otherwise, Russian roulette from ROULETTE_DEPTH on
+static const unsigned int DEFAULT_MAX_DEPTH = 8;
+static const unsigned int ROULETTE_DEPTH = 3;
+
+// Light samples of one shading point, all lights together (see Scene::sampleLights)
+static const unsigned int MAX_LIGHT_SAMPLES = 64;
+// Above LIGHT_TREE_THRESHOLD lights, a shading point only samples LIGHT_PICKS lights, picked with the light BVH
+static const unsigned int LIGHT_TREE_THRESHOLD = 16;
+static const unsigned int LIGHT_PICKS = 4;
+
+// Spread of the ray cone of a diffuse bounce : its direction is spread over the hemisphere, so later texture fetches
+// of the path read coarse levels
+static const float DIFFUSE_CONE_SPREAD = 0.1f;
+
 enum LightType {
 
 	LightType_Spherical,
@@ -36,20 +56,93 @@ struct Light {
 
 	float powerCorrection;
 
-	Light() : powerCorrection(1.0) {}
+	// shadow rays per shading point for an area light (a quad, or a sphere of non zero radius), 1 for a point light
+	unsigned int samples;
+
+	// distance at which the diffuse and specular intensities fall to one half, 0 for no falloff
+	float range;
+
+	Light() : type(LightType_Spherical), radius(0.f), powerCorrection(1.0), samples(4), range(0.f) {}
+
+	bool isPoint() const { return type == LightType_Spherical ? radius <= 0.f : quad.vertices.size() < 4; }
+	unsigned int sampleCount() const { return isPoint() ? 1 : samples; }
+	// a quad only lights the side of its normal
+	bool isOneSided() const { return type == LightType_Quad && !isPoint(); }
+
+	// Box, power and emission cone, for the light BVH
+	LightBounds lightBounds() const {
+
+		LightBounds result;
+		if(type == LightType_Quad && !isPoint()) {
+			for(unsigned int v = 0; v < 4; v++) result.bounds.extend(quad.vertices[v].position);
+			result.axis = quad.vertices[0].normal;
+			result.cosTheta = 0.f;
+		} else {
+			result.bounds.extend(pos - Vec3(radius, radius, radius));
+			result.bounds.extend(pos + Vec3(radius, radius, radius));
+		}
+		result.power = (0.2126f * material[0] + 0.7152f * material[1] + 0.0722f * material[2]) * (diffuseIntensity + specularIntensity);
+		result.range = range;
+		return result;
+
+	}
+
+	// Point of the light seen from p, for (u, v) uniform in [0,1)^2 : a point of the quad, or of the disk of the sphere that faces p
+	Vec3 samplePoint(Vec3 const & p, float u, float v) const {
+
+		if(isPoint()) return pos;
+		if(type == LightType_Quad) {
+			Vec3 const & p0 = quad.vertices[0].position, & p1 = quad.vertices[1].position;
+			Vec3 const & p2 = quad.vertices[2].position, & p3 = quad.vertices[3].position;
+			return (1.f - v) * ((1.f - u) * p0 + u * p1) + v * ((1.f - u) * p3 + u * p2);
+		}
+		Vec3 axis = pos - p;
+		float distance = axis.length();
+		if(distance <= radius) return pos;
+		axis /= distance;
+		Vec3 tangent = axis.getOrthogonal();
+		tangent.normalize();
+		Vec3 bitangent = Vec3::cross(axis, tangent);
+		float r = radius * sqrtf(u), phi = 2.f * (float)M_PI * v;
+		return pos + (r * cosf(phi)) * tangent + (r * sinf(phi)) * bitangent;
+
+	}
 
 };
 
+// Closest hit found by the traversal : kept small, the attributes of the surface are only
+// fetched for the final hit (see Scene::surfacePoint).
 struct RaySceneIntersection {
 
 	bool intersectionExists;
-	unsigned int typeOfIntersectedObject;
+	unsigned int typeOfIntersectedObject; // 0 mesh, 1 sphere, 2 square
 	unsigned int objectIndex;
+	unsigned int primitiveIndex; // triangle of a mesh
 	float t;
-	RayTriangleIntersection rayMeshIntersection;
-	RaySphereIntersection raySphereIntersection;
-	RaySquareIntersection raySquareIntersection;
-	RaySceneIntersection() : intersectionExists(false), t(FLT_MAX) {}
+	float b1, b2; // barycentric coordinates of the 2nd and 3rd corners of the triangle, uv on a square
+	RaySceneIntersection() : intersectionExists(false), typeOfIntersectedObject(-1), objectIndex(-1), primitiveIndex(0), t(FLT_MAX), b1(0.f), b2(0.f) {}
+
+};
+
+// A point on a light, and the weight of its contribution to the shading point it was drawn for
+struct LightSample {
+
+	Vec3 point;
+	unsigned int light;
+	float weight;
+
+};
+
+struct SurfacePoint {
+
+	Vec3 position;
+	Vec3 normal;
+	float u, v;
+	Material const * material;
+	// material color, times the texture if the material has one
+	Vec3 color;
+	// width of the ray cone at the hit
+	float footprint;
 
 };
 
@@ -60,9 +153,25 @@ class Scene {
 	std::vector<Square> squares;
 	std::vector<Light> lights;
 
+	// over every mesh, sphere and square, see build_bvh
+	BVH bvh;
+
+	// indexed by Material::texture
+	std::vector<Texture> textures;
+
+	// Shading data of the lights, one array per field (a Light also carries the mesh of its GL preview), see build_lights
+	std::vector<Vec3> lightColors;
+	std::vector<float> lightDiffuse, lightSpecular, lightRange2;
+	// emission side of one sided lights, null for the others
+	std::vector<Vec3> lightFront;
+	float ambientIntensity;
+	// light samples per shading point, and the hierarchy that picks them in scenes with many lights
+	unsigned int lightSamplesPerPoint;
+	LightBVH lightBVH;
+
 	public:
 
-		Scene() {}
+		Scene() : ambientIntensity(0.f), lightSamplesPerPoint(0) {}
 
 		void draw() {
 
@@ -82,167 +191,575 @@ class Scene {
 
 		}
 
-		RaySceneIntersection computeIntersection(Ray const & ray) {
+		AABB bounds() const { return bvh.bounds(); }
 
-			RaySceneIntersection result;
-			result.intersectionExists = false;
-			result.objectIndex = -1;
-			result.typeOfIntersectedObject = -1;
-			result.t = FLT_MAX;
-
-			int meshesCount = meshes.size();
-			for(int i = 0; i < meshesCount; i++) {
-				RayTriangleIntersection tmp = meshes[i].intersect(ray);
-				if(tmp.intersectionExists && result.t > tmp.t) {
-					result.intersectionExists = true;
-					result.objectIndex = i;
-					result.typeOfIntersectedObject = 0;
-					result.t = tmp.t;
-					result.rayMeshIntersection = tmp;
-				}
-			}
+		// Shadow rays per shading point of every area light of the scene
+		void setLightSamples(unsigned int samples) {
+			for(unsigned int l = 0; l < lights.size(); l++) lights[l].samples = samples;
+			build_lights();
+		}
 
-			int spheresCount = spheres.size();
-			for(int i = 0; i < spheresCount; i++) {
-				RaySphereIntersection tmp = spheres[i].intersect(ray);
-				if(tmp.intersectionExists && result.t > tmp.t) {
-					result.intersectionExists = true;
-					result.objectIndex = i;
-					result.typeOfIntersectedObject = 1;
-					result.t = tmp.t;
-					result.raySphereIntersection = tmp;
-				}
+		// Loads a texture for Material::texture, or a normal map for Material::normalMap : its index, -1 if the image
+		// could not be read. Normal maps only need two channels and are kept compressed (BC5) from the start.
+		int addTexture(std::string const & filename, bool normalMap = false) {
+			Texture texture;
+			if(!texture.load(filename)) return -1;
+			texture.setNormalMap(normalMap);
+			if(normalMap) texture.compress();
+			textures.push_back(texture);
+			return textures.size() - 1;
+		}
+
+		// Block compression of every texture (see Texture::compress)
+		void compressTextures() {
+			for(unsigned int i = 0; i < textures.size(); i++) textures[i].compress();
+		}
+
+		// Memory of the textures, as stored and uncompressed, and the average time of a filtered fetch (nanoseconds)
+		unsigned int textureStatistics(size_t & bytes, size_t & uncompressedBytes, double & fetchCost) const {
+			bytes = uncompressedBytes = 0;
+			fetchCost = 0.0;
+			for(unsigned int i = 0; i < textures.size(); i++) {
+				bytes += textures[i].memoryBytes();
+				uncompressedBytes += textures[i].uncompressedBytes();
+				fetchCost += textures[i].fetchCost() / textures.size();
 			}
+			return textures.size();
+		}
 
-			int squaresCount = squares.size();
-			for(int i = 0; i < squaresCount; i++) {
-				RaySquareIntersection tmp = squares[i].intersect(ray);
-				if(tmp.intersectionExists && result.t > tmp.t) {
-					result.intersectionExists = true;
-					result.objectIndex = i;
-					result.typeOfIntersectedObject = 2;
-					result.t = tmp.t;
-					result.raySquareIntersection = tmp;
-				}
+		// Must be called once the lights are in place (build_bvh does it)
+		void build_lights() {
+
+			unsigned int n = lights.size();
+			lightColors.resize(n);
+			lightDiffuse.resize(n);
+			lightSpecular.resize(n);
+			lightRange2.resize(n);
+			lightFront.resize(n);
+			ambientIntensity = 0.f;
+			std::vector<LightBounds> bounds(n);
+			for(unsigned int l = 0; l < n; l++) {
+				lightColors[l] = lights[l].material;
+				lightDiffuse[l] = lights[l].diffuseIntensity;
+				lightSpecular[l] = lights[l].specularIntensity;
+				lightRange2[l] = lights[l].range * lights[l].range;
+				lightFront[l] = lights[l].isOneSided() ? lights[l].quad.vertices[0].normal : Vec3(0.f, 0.f, 0.f);
+				ambientIntensity += lights[l].ambientIntensity;
+				bounds[l] = lights[l].lightBounds();
 			}
 
-			return result;
+			lightBVH.clear();
+			if(n > LIGHT_TREE_THRESHOLD) {
+				lightBVH.build(bounds);
+				lightSamplesPerPoint = LIGHT_PICKS;
+			} else {
+				lightSamplesPerPoint = 0;
+				for(unsigned int l = 0; l < n; l++) lightSamplesPerPoint += lightBudget(l, lightSamplesPerPoint);
+			}
 
 		}
 
-		Vec3 rayTraceRecursive( Ray ray , int NRemainingBounces ) {
+		// Must be called once the objects of the scene are in place : the intersections only go through the BVH.
+		// Meshes and squares whose vertices or transformations changed are rebuilt first.
+		void build_bvh() {
+
+			for(unsigned int i = 0; i < meshes.size(); i++) meshes[i].update_arrays();
+			for(unsigned int i = 0; i < squares.size(); i++) squares[i].update_arrays();
+
+			std::vector<BVHPrimitive> primitives;
+			primitives.reserve(meshes.size() + spheres.size() + squares.size());
+			for(unsigned int i = 0; i < meshes.size(); i++) {
+				AABB bounds;
+				for(unsigned int v = 0; v < meshes[i].vertices.size(); v++) bounds.extend(meshes[i].vertices[v].position);
+				if(!bounds.empty()) primitives.push_back(BVHPrimitive(bounds, 0, i));
+			}
+			for(unsigned int i = 0; i < spheres.size(); i++) {
+				AABB bounds;
+				Vec3 radius(spheres[i].m_radius, spheres[i].m_radius, spheres[i].m_radius);
+				bounds.extend(spheres[i].m_center - radius);
+				bounds.extend(spheres[i].m_center + radius);
+				primitives.push_back(BVHPrimitive(bounds, 1, i));
+			}
+			for(unsigned int i = 0; i < squares.size(); i++) {
+				AABB bounds;
+				for(unsigned int v = 0; v < squares[i].vertices.size(); v++) bounds.extend(squares[i].vertices[v].position);
+				primitives.push_back(BVHPrimitive(bounds, 2, i));
+			}
+			bvh.build(primitives);
+			build_lights();
 
-			//TODO RaySceneIntersection raySceneIntersection = computeIntersection(ray);
-			RaySceneIntersection result = computeIntersection(ray);
+		}
 
-			if(NRemainingBounces == 0) {
-				Vec3 intersection;
-				switch(result.typeOfIntersectedObject) {
+		// Closest hit at a distance in [ray.tMin(), ray.tMax()[
+		RaySceneIntersection computeIntersection(Ray const & ray) const {
+
+			RaySceneIntersection result;
+			float tMax = ray.tMax();
+			bvh.traverse(ray, tMax, [&](unsigned int type, unsigned int i, float & tClosest) {
+				float t, tFar = FLT_MAX, b1 = 0.f, b2 = 0.f;
+				unsigned int primitive = 0;
+				switch(type) {
 					case 0:
-						intersection = result.rayMeshIntersection.intersection;
+						// a mesh hit at tClosest exactly can still win the tie (see closerHit)
+						if(!meshes[i].hit(ray, t, primitive, b1, b2, std::nextafter(tClosest, FLT_MAX))) return;
 						break;
 					case 1:
-						intersection = result.raySphereIntersection.intersection;
-						break;
-					case 2:
-						intersection = result.raySquareIntersection.intersection;
+						if(!spheres[i].hit(ray, t, &tFar)) return;
+						if(t < ray.tMin()) t = tFar;
 						break;
 					default:
-						std::cerr << "rayTrace::Error, invalid object type\n";
-						exit(EXIT_FAILURE);
-				}
-				if(result.intersectionExists && (intersection - (ray.origin() + ray.direction())).length() < ray.direction().length()) return Vec3(-1.f, -1.f, -1.f);
-				return Vec3(1.f, 1.f, 1.f);
-			} else if(NRemainingBounces == 1) {
-				if(!result.intersectionExists) return Vec3(0.f, 0.f, 0.f);
-				Vec3 intersection, normal, color;
-				Vec3 k_ambient, k_diffuse, k_specular;
-				float shininess;
-
-				switch(result.typeOfIntersectedObject) {
-					case 0:
-						k_ambient = meshes[result.objectIndex].material.ambient_material;
-						k_diffuse = meshes[result.objectIndex].material.diffuse_material;
-						k_specular = meshes[result.objectIndex].material.specular_material;
-						color = meshes[result.objectIndex].material.color;
-						shininess = meshes[result.objectIndex].material.shininess;
-						intersection = result.rayMeshIntersection.intersection;
-						normal = result.rayMeshIntersection.normal;
-						break;
-					case 1:
-						k_ambient = spheres[result.objectIndex].material.ambient_material;
-						k_diffuse = spheres[result.objectIndex].material.diffuse_material;
-						k_specular = spheres[result.objectIndex].material.specular_material;
-						color = spheres[result.objectIndex].material.color;
-						shininess = spheres[result.objectIndex].material.shininess;
-						intersection = result.raySphereIntersection.intersection;
-						normal = result.raySphereIntersection.normal;
+						if(!squares[i].hit(ray, t, b1, b2)) return;
 						break;
-					case 2:
-						k_ambient = squares[result.objectIndex].material.ambient_material;
-						k_diffuse = squares[result.objectIndex].material.diffuse_material;
-						k_specular = squares[result.objectIndex].material.specular_material;
-						color = squares[result.objectIndex].material.color;
-						shininess = squares[result.objectIndex].material.shininess;
-						intersection = result.raySquareIntersection.intersection;
-						normal = result.raySquareIntersection.normal;
-						break;
-					default:
-						std::cerr << "rayTrace::Error, invalid object type\n";
-						exit(EXIT_FAILURE);
 				}
+				if(t < ray.tMin() || t >= ray.tMax()) return;
+				if(!closerHit(result, t, type, i)) return;
+				result.intersectionExists = true;
+				result.typeOfIntersectedObject = type;
+				result.objectIndex = i;
+				result.primitiveIndex = primitive;
+				result.t = t;
+				result.b1 = b1;
+				result.b2 = b2;
+				tClosest = t;
+			});
+
+			return result;
+
+		}
+
+		// Any hit query for shadow rays : is there an object at a distance in [ray.tMin(), tMax[ ?
+		// Stops at the first blocker found, without computing hit points nor normals.
+		bool occluded(Ray const & ray, float tMax) const {
+
+			float tMin = ray.tMin();
+			return bvh.traverseAny(ray, tMax, [&](unsigned int type, unsigned int i) {
+				switch(type) {
+					case 0: return meshes[i].intersects(ray, tMin, tMax);
+					case 1: return spheres[i].intersects(ray, tMin, tMax);
+					default: return squares[i].intersects(ray, tMin, tMax);
+				}
+			});
+
+		}
 
-				Vec3 ambient, diffuse, specular;
-				ambient = Vec3(0.f, 0.f, 0.f);
-				diffuse = Vec3(0.f, 0.f, 0.f);
-				specular = Vec3(0.f, 0.f, 0.f);
+		bool occluded(Ray const & ray) const { return occluded(ray, ray.tMax()); }
 
-				int lightsCount = lights.size();
-				int litCheck = lightsCount;
-				for(int i = 0; i < lightsCount; i++) {
-					Vec3 tmp = rayTraceRecursive(Ray(0.0001f * normal + intersection, lights[i].pos - intersection), 0);
-					if(tmp[0] < 0.f) litCheck--;
+		// On equal distances, the first object in (meshes, spheres, squares) order wins whatever the traversal order
+		static bool closerHit(RaySceneIntersection const & result, float t, unsigned int type, unsigned int index) {
+			if(!result.intersectionExists || t < result.t) return true;
+			if(t > result.t) return false;
+			return type < result.typeOfIntersectedObject || (type == result.typeOfIntersectedObject && index < result.objectIndex);
+		}
+
+		// Number of samples of light l when k samples of the shading point are taken already
+		unsigned int lightBudget(unsigned int l, unsigned int k) const {
+			return std::min(lights[l].sampleCount(), MAX_LIGHT_SAMPLES - k);
+		}
+
+		unsigned int lightSampleCount() const { return lightSamplesPerPoint; }
+
+		// lightSampleCount() samples of the lights seen from a surface point.
+		// With few lights, every light is sampled, light after light. The budget of a light is laid on a grid over its
+		// surface, shifted by one 2D sample of the pixel (Cranley-Patterson rotation) : the points of one shading point are
+		// stratified, and the shifts of the samples of a pixel are stratified by its sampler, so that the AA samples of a
+		// pixel share one well spread pattern instead of drawing their own points.
+		// With many lights, LIGHT_PICKS lights are picked with the light BVH, from stratified numbers, one point each.
+		// A light sample weighs 1 / (its probability * LIGHT_PICKS) : the estimate of the sum over all lights is unbiased.
+		void sampleLights(SurfacePoint const & surface, PixelSampler & sampler, LightSample * samples) const {
+
+			Vec3 const & position = surface.position;
+			if(!lightBVH.empty()) {
+				float shiftPick, unused;
+				sampler.get2D(shiftPick, unused);
+				for(unsigned int k = 0; k < LIGHT_PICKS; k++) {
+					float u, v;
+					sampler.get2D(u, v);
+					float pick = sampling::fract((k + 0.5f) / LIGHT_PICKS + shiftPick), pdf;
+					unsigned int l;
+					if(!lightBVH.sample(position, surface.normal, pick, l, pdf)) {
+						samples[k].point = position;
+						samples[k].light = 0;
+						samples[k].weight = 0.f;
+						continue;
+					}
+					samples[k].point = lights[l].samplePoint(position, u, v);
+					samples[k].light = l;
+					samples[k].weight = 1.f / (pdf * LIGHT_PICKS);
 				}
-				// if(litCheck == 0) return Vec3(0.f, 0.f, 0.f);
+				return;
+			}
 
-				for(int i = 0; i < lightsCount; i++) {
+			unsigned int k = 0;
+			for(unsigned int l = 0; l < lights.size(); l++) {
+				unsigned int n = lightBudget(l, k);
+				if(n == 1 && lights[l].isPoint()) {
+					samples[k].point = lights[l].pos;
+					samples[k].light = l;
+					samples[k++].weight = 1.f;
+					continue;
+				}
+				float shiftU, shiftV;
+				sampler.get2D(shiftU, shiftV);
+				unsigned int columns = (unsigned int)ceilf(sqrtf((float)n)), rows = (n + columns - 1) / columns;
+				for(unsigned int j = 0; j < n; j++) {
+					float u = sampling::fract(((j % columns) + 0.5f) / columns + shiftU);
+					float v = sampling::fract(((j / columns) + 0.5f) / rows + shiftV);
+					samples[k].point = lights[l].samplePoint(position, u, v);
+					samples[k].light = l;
+					samples[k++].weight = 1.f / n;
+				}
+			}
 
-					ambient += lights[i].ambientIntensity * k_ambient;
+		}
 
-					Vec3 lightVector = lights[i].pos - intersection;
-					lightVector.normalize();
+		// Shadow test of every light sample of a surface point. Samples of weight 0 are not traced.
+		void visibleLightSamples(SurfacePoint const & surface, LightSample const * samples, unsigned char * visible) const {
 
-					float d_angle = Vec3::dot(lightVector, normal);
+			Vec3 shadowOrigin = 0.0001f * surface.normal + surface.position;
+			unsigned int count = lightSampleCount();
+			for(unsigned int k = 0; k < count; k++) {
+				Vec3 const & target = samples[k].point;
+				visible[k] = samples[k].weight > 0.f && !occluded(Ray(shadowOrigin, target - surface.position), (target - shadowOrigin).length());
+			}
 
-					diffuse += lights[i].diffuseIntensity * k_diffuse * d_angle * lights[i].material;
+		}
 
-					Vec3 reflectedVector = 2*Vec3::dot(lightVector, normal)*normal - lightVector;
+		// Path tracing, one vertex per iteration : throughput is the weight of the path up to the current vertex.
+		// Diffuse surfaces add their Phong shading before they scatter. The ambient term of the Phong model stands for
+		// the indirect light, so it is only kept until the path takes a diffuse bounce.
+		// firstSamples / firstVisible are the light samples of the first hit and their visibility if the caller already knows them, NULL otherwise.
+		// cone is the ray cone of the camera ray, it selects the texture levels along the path.
+		Vec3 tracePath(Ray ray, RaySceneIntersection hit, LightSample const * firstSamples, unsigned char const * firstVisible, PixelSampler & sampler, unsigned int maxDepth, RayCone cone) const {
+
+			Vec3 radiance(0.f, 0.f, 0.f), throughput(1.f, 1.f, 1.f);
+			bool ambient = true;
+			LightSample samples[MAX_LIGHT_SAMPLES];
+			unsigned char visible[MAX_LIGHT_SAMPLES];
+			for(unsigned int depth = 0; depth < maxDepth && hit.intersectionExists; depth++) {
+
+				SurfacePoint surface = surfacePoint(ray, hit, cone);
+				if(surface.material->type == Material_Diffuse_Blinn_Phong) {
+					if(depth == 0 && firstSamples != NULL) {
+						radiance += throughput * shade(ray, surface, firstSamples, firstVisible, ambient);
+					} else {
+						sampleLights(surface, sampler, samples);
+						visibleLightSamples(surface, samples, visible);
+						radiance += throughput * shade(ray, surface, samples, visible, ambient);
+					}
+					ambient = false;
+				}
+				if(!scatter(ray, surface, depth, sampler, throughput, cone)) break;
+				hit = computeIntersection(ray);
 
-					float s_angle = Vec3::dot(reflectedVector, -1*ray.direction());
-					if(s_angle < 0) s_angle = 0;
-					else s_angle = powf(s_angle, shininess);
+			}
+			return radiance;
 
-					specular += lights[i].specularIntensity * k_specular * s_angle * lights[i].material;
+		}
 
+		// Next segment of a path leaving surface, the vertex number depth : ray and its cone are replaced by the scattered
+		// ones and throughput is updated. Diffuse surfaces scatter in a cosine distributed direction, mirrors reflect, glass
+		// reflects or refracts with the Fresnel probability. The cone goes on from its width at the hit; specular bounces
+		// keep its spread (the curvature of the surface is not taken into account), diffuse ones widen it.
+		// Returns false if the path stops there (Russian roulette).
+		bool scatter(Ray & ray, SurfacePoint const & surface, unsigned int depth, PixelSampler & sampler, Vec3 & throughput, RayCone & cone) const {
+
+			Material const & material = *surface.material;
+			// every vertex takes the same sample dimensions, whatever its material
+			float u1, u2, uChoice, uRoulette;
+			sampler.get2D(u1, u2);
+			sampler.get2D(uChoice, uRoulette);
+
+			Vec3 d = ray.direction();
+			// normal on the side the ray comes from
+			bool inside = Vec3::dot(d, surface.normal) > 0.f;
+			Vec3 n = inside ? -1.f * surface.normal : surface.normal;
+			Vec3 direction;
+			bool transmitted = false;
+			switch(material.type) {
+				case Material_Mirror:
+					direction = reflect(d, n);
+					throughput = throughput * surface.color;
+					break;
+				case Material_Glass: {
+					float etaI = 1.f, etaT = material.index_medium;
+					if(inside) std::swap(etaI, etaT);
+					float cosI = -Vec3::dot(d, n), cosT;
+					float reflectance = fresnel_dielectric(cosI, etaI, etaT, cosT);
+					if(uChoice < reflectance) {
+						direction = reflect(d, n);
+					} else {
+						direction = refract(d, n, etaI / etaT, cosI, cosT);
+						direction.normalize();
+						transmitted = true;
+						throughput = throughput * (material.transparency * surface.color);
+					}
+					break;
 				}
+				default:
+					direction = sample_cosine_hemisphere(n, u1, u2);
+					throughput = throughput * (surface.color * material.diffuse_material);
+					break;
+			}
+
+			// Russian roulette : the lower the throughput, the more likely the path stops. Paths that keep all their energy
+			// (two facing white mirrors) are still cut at maxDepth.
+			if(depth + 1 >= ROULETTE_DEPTH) {
+				float survival = std::min(0.95f, std::max(throughput[0], std::max(throughput[1], throughput[2])));
+				if(uRoulette >= survival) return false;
+				throughput /= survival;
+			}
 
-				color = Vec3::clamp(color * (ambient + (litCheck == 0 ? 0.f : 1.f)*(diffuse + specular)), 0.f, 1.f);
-				// color = Vec3::clamp(color * (ambient + diffuse + specular), 0.f, 1.f);
+			ray = Ray(surface.position + (transmitted ? -0.0001f : 0.0001f) * n, direction);
+			cone = RayCone(surface.footprint, material.type == Material_Diffuse_Blinn_Phong ? DIFFUSE_CONE_SPREAD : cone.spread);
+			return true;
 
-				return color;
+		}
+
+		// Position, normal, uv, material and color of a hit. The texture level of a textured material is the one of the
+		// footprint of cone on the surface : its width at the hit, stretched by the obliquity of the ray.
+		SurfacePoint surfacePoint(Ray const & ray, RaySceneIntersection const & hit, RayCone const & cone = RayCone()) const {
+
+			SurfacePoint surface;
+			surface.position = ray.origin() + hit.t * ray.direction();
+			switch(hit.typeOfIntersectedObject) {
+				case 0:
+					meshes[hit.objectIndex].surface(hit.primitiveIndex, hit.b1, hit.b2, surface.normal, surface.u, surface.v);
+					surface.material = &meshes[hit.objectIndex].material;
+					break;
+				case 1:
+					spheres[hit.objectIndex].surface(surface.position, surface.normal, surface.u, surface.v);
+					surface.material = &spheres[hit.objectIndex].material;
+					break;
+				case 2:
+					surface.normal = squares[hit.objectIndex].m_normal;
+					squares[hit.objectIndex].texCoords(hit.b1, hit.b2, surface.u, surface.v);
+					surface.material = &squares[hit.objectIndex].material;
+					break;
+				default:
+					std::cerr << "rayTrace::Error, invalid object type\n";
+					exit(EXIT_FAILURE);
+			}
+			surface.color = surface.material->color;
+			surface.footprint = cone.widthAt(hit.t);
+			Material const & material = *surface.material;
+			if(material.texture < 0 && material.normalMap < 0) return surface;
+
+			// footprint of the hit in texture coordinates, stretched at grazing angles
+			float density;
+			if(hit.typeOfIntersectedObject == 0) density = meshes[hit.objectIndex].uvDensity(hit.primitiveIndex);
+			else if(hit.typeOfIntersectedObject == 1) density = spheres[hit.objectIndex].uvDensity(surface.normal);
+			else density = squares[hit.objectIndex].uvDensity();
+			float cosine = std::max(0.01f, fabsf(Vec3::dot(ray.direction(), surface.normal)));
+			float uvFootprint = surface.footprint / cosine * density;
+
+			if(material.texture >= 0) {
+				Texture const & texture = textures[material.texture];
+				surface.color = surface.color * texture.sample(surface.u, surface.v, texture.level(uvFootprint * texture.resolution()));
+			}
+			if(material.normalMap >= 0) {
+				Texture const & normalMap = textures[material.normalMap];
+				Vec3 tangent;
+				float handedness;
+				if(hit.typeOfIntersectedObject == 0) meshes[hit.objectIndex].tangentFrame(hit.primitiveIndex, hit.b1, hit.b2, surface.normal, tangent, handedness);
+				else if(hit.typeOfIntersectedObject == 1) spheres[hit.objectIndex].tangentFrame(surface.normal, tangent, handedness);
+				else squares[hit.objectIndex].tangentFrame(tangent, handedness);
+				Vec3 bitangent = handedness * Vec3::cross(surface.normal, tangent);
+				Vec3 n = normalMap.sample(surface.u, surface.v, normalMap.level(uvFootprint * normalMap.resolution()));
+				Vec3 normal = (2.f * n[0] - 1.f) * tangent + (2.f * n[1] - 1.f) * bitangent + (2.f * n[2] - 1.f) * surface.normal;
+				normal.normalize();
+				// a perturbed normal turned away from the ray would shade the hit as seen from behind : keep the geometric one
+				float side = Vec3::dot(ray.direction(), surface.normal);
+				if(side * Vec3::dot(ray.direction(), normal) > 0.f) surface.normal = normal;
 			}
+			return surface;
 
 		}
 
+		// Phong shading of a hit, from the light samples of sampleLights that are visible.
+		// Each sample brings the diffuse and specular terms of its light, times its weight; samples of lights below the
+		// horizon of the hit, or behind a one sided light, bring nothing.
+		Vec3 shade(Ray const & ray, SurfacePoint const & surface, LightSample const * samples, unsigned char const * visible, bool withAmbient = true) const {
 
-		Vec3 rayTrace( Ray const & rayStart ) {
+			Vec3 const & intersection = surface.position;
+			Vec3 const & normal = surface.normal;
+			Vec3 k_ambient = surface.material->ambient_material;
+			Vec3 k_diffuse = surface.material->diffuse_material;
+			Vec3 k_specular = surface.material->specular_material;
+			Vec3 color = surface.color;
+			float shininess = surface.material->shininess;
+
+			Vec3 ambient, diffuse, specular;
+			ambient = Vec3(0.f, 0.f, 0.f);
+			diffuse = Vec3(0.f, 0.f, 0.f);
+			specular = Vec3(0.f, 0.f, 0.f);
+
+			if(withAmbient) ambient = ambientIntensity * k_ambient;
+
+			unsigned int count = lightSampleCount();
+			for(unsigned int k = 0; k < count; k++) {
+
+				if(!visible[k]) continue;
+
+				unsigned int i = samples[k].light;
+				Vec3 lightVector = samples[k].point - intersection;
+				float distance2 = lightVector.squareLength();
+				lightVector.normalize();
+
+				float d_angle = Vec3::dot(lightVector, normal);
+				if(d_angle <= 0.f || Vec3::dot(lightVector, lightFront[i]) > 0.f) continue;
+
+				float weight = samples[k].weight;
+				if(lightRange2[i] > 0.f) weight *= lightRange2[i] / (lightRange2[i] + distance2);
+
+				diffuse += (weight * lightDiffuse[i] * d_angle) * k_diffuse * lightColors[i];
+
+				Vec3 reflectedVector = 2*d_angle*normal - lightVector;
+
+				float s_angle = Vec3::dot(reflectedVector, -1*ray.direction());
+				if(s_angle < 0) s_angle = 0;
+				else s_angle = powf(s_angle, shininess);
+
+				specular += (weight * lightSpecular[i] * s_angle) * k_specular * lightColors[i];
+
+			}
+
+			color = Vec3::clamp(color * (ambient + diffuse + specular), 0.f, 1.f);
 
-			//TODO appeler la fonction recursive
-			Vec3 color = rayTraceRecursive(rayStart, 1);
 			return color;
 
 		}
 
+		// Closest hit of every ray of the packet, as (type, index, t) in the packet.
+		// With anyHit, any hit is enough (shadow rays) : the traversal stops once every ray has one.
+		void intersectPacket(RayPacket & packet, bool anyHit = false) const {
+
+			bvh.traversePacket(packet, [&](unsigned int type, unsigned int i) {
+				if(type == 1) intersect_packet_sphere(packet, spheres[i], 1, i);
+				else if(type == 2) intersect_packet_square(packet, squares[i], 2, i);
+				else {
+					// meshes are not vectorized yet : one ray at a time
+					for(unsigned int lane = 0; lane < packet.size; lane++) {
+						Ray ray(Vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]), Vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]));
+						if(anyHit) {
+							if(packet.type[lane] < 0.f && meshes[i].intersects(ray, 0.f, packet.t[lane])) {
+								packet.type[lane] = 0.f;
+								packet.index[lane] = (float)i;
+							}
+							continue;
+						}
+						RayTriangleIntersection tmp = meshes[i].intersect(ray);
+						if(tmp.intersectionExists && packet.t[lane] > tmp.t) {
+							packet.t[lane] = tmp.t;
+							packet.type[lane] = 0.f;
+							packet.index[lane] = (float)i;
+						}
+					}
+				}
+			}, anyHit);
+
+		}
+
+		// Full intersection record of one lane : the closest primitive found by the packet is intersected again with the scalar code
+		RaySceneIntersection packetIntersection(RayPacket const & packet, unsigned int lane, Ray const & ray) const {
+
+			RaySceneIntersection result;
+			if(packet.type[lane] < 0.f) return result;
+
+			unsigned int type = (unsigned int)packet.type[lane], index = (unsigned int)packet.index[lane];
+			switch(type) {
+				case 0:
+					result.intersectionExists = meshes[index].hit(ray, result.t, result.primitiveIndex, result.b1, result.b2);
+					break;
+				case 1:
+					result.intersectionExists = spheres[index].hit(ray, result.t);
+					break;
+				case 2:
+					result.intersectionExists = squares[index].hit(ray, result.t, result.b1, result.b2);
+					break;
+			}
+			// the SIMD and scalar tests disagree on a grazing ray : trust the scalar code
+			if(!result.intersectionExists) return computeIntersection(ray);
+			result.typeOfIntersectedObject = type;
+			result.objectIndex = index;
+			return result;
+
+		}
+
+		// Same result as visibleLightSamples for n <= RAY_PACKET_SIZE surface points, the samples of surface i starting
+		// at samples[i * lightSampleCount()] and its visibility at visible[i * lightSampleCount()].
+		// The shadow rays of one light sample index go as one packet; when they all target the same point light, they all
+		// stop there and the packet gets a bounding cone.
+		void visibleLightSamplesPacket(SurfacePoint const * const * surfaces, LightSample const * samples, unsigned int n, unsigned char * visible) const {
+
+			if(n == 0) return;
+			unsigned int count = lightSampleCount();
+			Ray shadowRays[RAY_PACKET_SIZE];
+			for(unsigned int k = 0; k < count; k++) {
+				bool samePointLight = lights[samples[k].light].isPoint();
+				for(unsigned int i = 0; i < n; i++) {
+					LightSample const & sample = samples[i * count + k];
+					Vec3 shadowOrigin = 0.0001f * surfaces[i]->normal + surfaces[i]->position;
+					if(sample.weight > 0.f) shadowRays[i] = Ray(shadowOrigin, sample.point - surfaces[i]->position, 0.f, (sample.point - shadowOrigin).length());
+					else shadowRays[i] = Ray(shadowOrigin, surfaces[i]->normal, 0.f, 0.f);
+					samePointLight = samePointLight && sample.weight > 0.f && sample.light == samples[k].light;
+				}
+				RayPacket shadows;
+				shadows.set(shadowRays, n);
+				if(samePointLight) shadows.computeCone(lights[samples[k].light].pos, -1.f);
+				intersectPacket(shadows, true);
+				for(unsigned int i = 0; i < n; i++)
+					visible[i * count + k] = samples[i * count + k].weight > 0.f && shadows.type[i] < 0.f;
+			}
+
+		}
+
+		// Same result as rayTrace for n <= RAY_PACKET_SIZE rays leaving origin, samplers[i] being the sampler of ray i and
+		// cone the cone of every ray.
+		// The first vertex is traced as packets : one packet of primary rays, then one packet of shadow rays for
+		// each sample of the lights at the diffuse hits. The rest of each path is traced one ray at a time.
+		void rayTracePacket(Vec3 const & origin, Vec3 const * directions, unsigned int n, PixelSampler * samplers, unsigned int maxDepth, RayCone const & cone, Vec3 * colors) const {
+
+			Ray rays[RAY_PACKET_SIZE];
+			for(unsigned int i = 0; i < n; i++) rays[i] = Ray(origin, directions[i]);
+
+			RayPacket packet;
+			packet.set(rays, n);
+			packet.computeCone(origin, 1.f);
+			intersectPacket(packet);
+
+			RaySceneIntersection intersections[RAY_PACKET_SIZE];
+			SurfacePoint surfaces[RAY_PACKET_SIZE];
+			SurfacePoint const * diffuseSurfaces[RAY_PACKET_SIZE];
+			int diffuseIndex[RAY_PACKET_SIZE];
+			unsigned int diffuseCount = 0;
+			unsigned int count = lightSampleCount();
+			LightSample samples[RAY_PACKET_SIZE * MAX_LIGHT_SAMPLES];
+			unsigned char visible[RAY_PACKET_SIZE * MAX_LIGHT_SAMPLES];
+			for(unsigned int i = 0; i < n; i++) {
+				intersections[i] = packetIntersection(packet, i, rays[i]);
+				diffuseIndex[i] = -1;
+				if(!intersections[i].intersectionExists || maxDepth == 0) continue;
+				surfaces[i] = surfacePoint(rays[i], intersections[i], cone);
+				if(surfaces[i].material->type != Material_Diffuse_Blinn_Phong) continue;
+				sampleLights(surfaces[i], samplers[i], &samples[diffuseCount * count]);
+				diffuseSurfaces[diffuseCount] = &surfaces[i];
+				diffuseIndex[i] = diffuseCount++;
+			}
+			visibleLightSamplesPacket(diffuseSurfaces, samples, diffuseCount, visible);
+
+			for(unsigned int i = 0; i < n; i++) {
+				if(diffuseIndex[i] < 0) colors[i] = tracePath(rays[i], intersections[i], NULL, NULL, samplers[i], maxDepth, cone);
+				else colors[i] = tracePath(rays[i], intersections[i], &samples[diffuseIndex[i] * count], &visible[diffuseIndex[i] * count], samplers[i], maxDepth, cone);
+			}
+
+		}
+
+		Vec3 rayTrace(Ray const & ray, PixelSampler & sampler, unsigned int maxDepth = DEFAULT_MAX_DEPTH, RayCone const & cone = RayCone()) const {
+
+			return tracePath(ray, computeIntersection(ray), NULL, NULL, sampler, maxDepth, cone);
+
+		}
+
 		void setup_single_sphere(Vec3 color = Vec3(0.f, 0.f, 0.f), Vec3 pos = Vec3(0.f, 0.f, 0.f), float radius = 1.f) {
 
 			meshes.clear();
@@ -269,8 +786,7 @@ class Scene {
 				Sphere &s = spheres[spheres.size() - 1];
 				s.m_center = pos;
 				s.m_radius = radius;
-				s.build_arrays();
-				s.material.type = Material_Mirror;
+				s.material.type = Material_Diffuse_Blinn_Phong;
 				s.material.color = color;
 				s.material.ambient_material = i_ambient;
         		s.material.diffuse_material = i_diffuse;
@@ -278,6 +794,8 @@ class Scene {
 				s.material.shininess = 20;
 			}
 
+			build_bvh();
+
 		}
 
 		void setup_two_spheres(Vec3 color1 = Vec3(0.f, 0.f, 0.f), Vec3 pos1 = Vec3(0.f, 0.f, 0.f), float radius1 = 1.f, Vec3 color2 = Vec3(0.f, 0.f, 0.f), Vec3 pos2 = Vec3(0.f, 0.f, 0.f), float radius2 = 1.f) {
@@ -306,8 +824,7 @@ class Scene {
 				Sphere &s = spheres[spheres.size() - 1];
 				s.m_center = pos1;
 				s.m_radius = radius1;
-				s.build_arrays();
-				s.material.type = Material_Mirror;
+				s.material.type = Material_Diffuse_Blinn_Phong;
 				s.material.color = color1;
 				s.material.ambient_material = i_ambient;
         		s.material.diffuse_material = i_diffuse;
@@ -320,8 +837,7 @@ class Scene {
 				Sphere &s = spheres[spheres.size() - 1];
 				s.m_center = pos2;
 				s.m_radius = radius2;
-				s.build_arrays();
-				s.material.type = Material_Mirror;
+				s.material.type = Material_Diffuse_Blinn_Phong;
 				s.material.color = color2;
 				s.material.ambient_material = i_ambient;
         		s.material.diffuse_material = i_diffuse;
@@ -329,6 +845,8 @@ class Scene {
 				s.material.shininess = 20;
 			}
 
+			build_bvh();
+
 		}
 
 		void setup_single_square() {
@@ -356,7 +874,6 @@ class Scene {
 				squares.resize(squares.size() + 1);
 				Square & s = squares[squares.size() - 1];
 				s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0., 0.), Vec3(0., 1., 0.), 2., 2.);
-				s.build_arrays();
 				s.material.color = Vec3(0.8, 0.8, 0.8);
 				s.material.ambient_material = i_ambient;
         		s.material.diffuse_material = i_diffuse;
@@ -364,6 +881,50 @@ class Scene {
 				s.material.shininess = 20;
 			}
 
+			build_bvh();
+
+		}
+
+		// Returns false if the mesh could not be loaded
+		bool setup_single_mesh(std::string const & filename, Vec3 color = Vec3(0.8f, 0.8f, 0.8f)) {
+
+			meshes.clear();
+			spheres.clear();
+			squares.clear();
+			lights.clear();
+
+			{
+				lights.resize(lights.size() + 1);
+				Light &light = lights[lights.size() - 1];
+				light.pos = Vec3(-5., 5., 5.);
+				light.radius = 2.5f;
+				light.powerCorrection = 2.f;
+				light.type = LightType_Spherical;
+				light.material = Vec3(1., 1., 1.);
+				light.ambientIntensity = 1.f;
+				light.diffuseIntensity = 1.f;
+				light.specularIntensity = 1.f;
+				light.isInCamSpace = false;
+			}
+
+			{
+				meshes.resize(meshes.size() + 1);
+				Mesh &m = meshes[meshes.size() - 1];
+				if(!m.loadOFF(filename)) {
+					meshes.clear();
+					return false;
+				}
+				m.centerAndScaleToUnit();
+				m.material.color = color;
+				m.material.ambient_material = i_ambient;
+				m.material.diffuse_material = i_diffuse;
+				m.material.specular_material = i_specular;
+				m.material.shininess = 20;
+			}
+
+			build_bvh();
+			return true;
+
 		}
 
 	void setup_cornell_box() {
@@ -377,7 +938,7 @@ class Scene {
 			lights.resize(lights.size() + 1);
 			Light &light = lights[lights.size() - 1];
 			light.pos = Vec3(0.0, 1.5, 0.0);
-			light.radius = 2.5f;
+			light.radius = 0.4f;
 			light.powerCorrection = 2.f;
 			light.type = LightType_Spherical;
 			light.material = Vec3(1., 1., 1.);
@@ -393,7 +954,6 @@ class Scene {
 			s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0., 0.), Vec3(0., 1., 0.), 2., 2.);
 			s.scale(Vec3(2., 2., 1.));
 			s.translate(Vec3(0., 0., -2.));
-			s.build_arrays();
 			s.material.color = Vec3(0., 1., 1.);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -409,7 +969,6 @@ class Scene {
 			s.scale(Vec3(2., 2., 1.));
 			s.translate(Vec3(0., 0., -2.));
 			s.rotate_y(90);
-			s.build_arrays();
 			s.material.color = Vec3(1., 0., 0.);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -424,7 +983,6 @@ class Scene {
 			s.translate(Vec3(0., 0., -2.));
 			s.scale(Vec3(2., 2., 1.));
 			s.rotate_y(-90);
-			s.build_arrays();
 			s.material.color = Vec3(0.0, 1.0, 0.0);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -439,7 +997,6 @@ class Scene {
 			s.translate(Vec3(0., 0., -2.));
 			s.scale(Vec3(2., 2., 1.));
 			s.rotate_x(-90);
-			s.build_arrays();
 			s.material.color = Vec3(1.0, 1.0, 1.0);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -454,7 +1011,6 @@ class Scene {
 			s.translate(Vec3(0., 0., -2.));
 			s.scale(Vec3(2., 2., 1.));
 			s.rotate_x(90);
-			s.build_arrays();
 			s.material.color = Vec3(1.0, 0.0, 1.0);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -469,7 +1025,6 @@ class Scene {
 			s.translate(Vec3(0., 0., -2.));
 			s.scale(Vec3(2., 2., 1.));
 			s.rotate_y(180);
-			s.build_arrays();
 			s.material.color = Vec3(1.0, 1.0, 1.0);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -483,8 +1038,7 @@ class Scene {
 			Sphere &s = spheres[spheres.size() - 1];
 			s.m_center = Vec3(1.0, -1.25, 0.5);
 			s.m_radius = 0.75f;
-			s.build_arrays();
-			s.material.type = Material_Mirror;
+			s.material.type = Material_Glass;
 			s.material.color = Vec3(1., 0., 0.);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -500,8 +1054,7 @@ class Scene {
 			Sphere &s = spheres[spheres.size() - 1];
 			s.m_center = Vec3(-1.0, -1.25, -0.5);
 			s.m_radius = 0.75f;
-			s.build_arrays();
-			s.material.type = Material_Glass;
+			s.material.type = Material_Mirror;
 			s.material.color = Vec3(1., 1., 0.);
 			s.material.ambient_material = i_ambient;
         	s.material.diffuse_material = i_diffuse;
@@ -511,6 +1064,128 @@ class Scene {
 			s.material.index_medium = 0.;
 		}
 
+		build_bvh();
+
+	}
+
+	// A floor lit by a 72 x 72 grid of small lights of short range, with three spheres in their midst
+	void setup_many_lights() {
+
+		meshes.clear();
+		spheres.clear();
+		squares.clear();
+		lights.clear();
+
+		const unsigned int grid = 72;
+		lights.resize(grid * grid);
+		for(unsigned int j = 0; j < grid; j++) {
+			for(unsigned int i = 0; i < grid; i++) {
+				Light &light = lights[j * grid + i];
+				light.pos = Vec3(-4.f + 8.f * (i + 0.5f) / grid, -0.9f, -4.f + 8.f * (j + 0.5f) / grid);
+				light.radius = 0.02f;
+				light.range = 0.25f;
+				light.type = LightType_Spherical;
+				unsigned int hash = sampling::hash(j * grid + i, 0x5eed);
+				light.material = Vec3(0.25f + 0.75f * ((hash & 0xff) / 255.f), 0.25f + 0.75f * (((hash >> 8) & 0xff) / 255.f), 0.25f + 0.75f * (((hash >> 16) & 0xff) / 255.f));
+				light.ambientIntensity = 1.f / (grid * grid);
+				light.diffuseIntensity = 0.1f;
+				light.specularIntensity = 0.1f;
+				light.isInCamSpace = false;
+			}
+		}
+
+		{ // Floor
+			squares.resize(squares.size() + 1);
+			Square &s = squares[squares.size() - 1];
+			s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0., 0.), Vec3(0., 1., 0.), 2., 2.);
+			s.translate(Vec3(0., 0., -1.));
+			s.scale(Vec3(4., 4., 1.));
+			s.rotate_x(-90);
+			s.material.color = Vec3(1.0, 1.0, 1.0);
+			s.material.ambient_material = i_ambient;
+			s.material.diffuse_material = i_diffuse;
+			s.material.specular_material = i_specular;
+			s.material.shininess = 16;
+		}
+
+		Vec3 centers[3] = { Vec3(-1.5, -0.5, 0.), Vec3(0., -0.5, -1.), Vec3(1.5, -0.5, 0.5) };
+		Vec3 colors[3] = { Vec3(1., 1., 1.), Vec3(1., 0.5, 0.2), Vec3(0.2, 0.5, 1.) };
+		for(unsigned int i = 0; i < 3; i++) {
+			spheres.resize(spheres.size() + 1);
+			Sphere &s = spheres[spheres.size() - 1];
+			s.m_center = centers[i];
+			s.m_radius = 0.5f;
+			s.material.type = Material_Diffuse_Blinn_Phong;
+			s.material.color = colors[i];
+			s.material.ambient_material = i_ambient;
+			s.material.diffuse_material = i_diffuse;
+			s.material.specular_material = i_specular;
+			s.material.shininess = 16;
+		}
+
+		build_bvh();
+
+	}
+
+	// Textured spheres on a large textured floor, that recedes to the horizon
+	void setup_textured() {
+
+		meshes.clear();
+		spheres.clear();
+		squares.clear();
+		lights.clear();
+		textures.clear();
+
+		{
+			lights.resize(lights.size() + 1);
+			Light &light = lights[lights.size() - 1];
+			light.pos = Vec3(-5, 5, 5);
+			light.radius = 2.5f;
+			light.powerCorrection = 2.f;
+			light.type = LightType_Spherical;
+			light.material = Vec3(1, 1, 1);
+			light.ambientIntensity = 1.f;
+			light.diffuseIntensity = 1.f;
+			light.specularIntensity = 1.f;
+			light.isInCamSpace = false;
+		}
+
+		{ // Floor, the texture and its relief repeated 16 times along each side
+			squares.resize(squares.size() + 1);
+			Square &s = squares[squares.size() - 1];
+			s.setQuad(Vec3(-1., -1., 0.), Vec3(1., 0., 0.), Vec3(0., 1., 0.), 2., 2., 0., 16., 0., 16.);
+			s.translate(Vec3(0., 0., -1.));
+			s.scale(Vec3(20., 20., 1.));
+			s.rotate_x(-90);
+			s.material.color = Vec3(1.0, 1.0, 1.0);
+			s.material.texture = addTexture("img/sphereTextures/s4.ppm");
+			s.material.normalMap = addTexture("img/normalMaps/n4.ppm", true);
+			s.material.ambient_material = i_ambient;
+			s.material.diffuse_material = i_diffuse;
+			s.material.specular_material = i_specular;
+			s.material.shininess = 16;
+		}
+
+		const char * files[3] = { "img/sphereTextures/s2.ppm", "img/sphereTextures/s6.ppm", "img/sphereTextures/s7.ppm" };
+		const char * normalMaps[3] = { "img/normalMaps/n1.ppm", "img/normalMaps/n2.ppm", "img/normalMaps/n3.ppm" };
+		Vec3 centers[3] = { Vec3(-2., 0., 0.), Vec3(0.5, 0., -3.), Vec3(3., 0., -8.) };
+		for(unsigned int i = 0; i < 3; i++) {
+			spheres.resize(spheres.size() + 1);
+			Sphere &s = spheres[spheres.size() - 1];
+			s.m_center = centers[i];
+			s.m_radius = 1.f;
+			s.material.type = Material_Diffuse_Blinn_Phong;
+			s.material.color = Vec3(1., 1., 1.);
+			s.material.texture = addTexture(files[i]);
+			s.material.normalMap = addTexture(normalMaps[i], true);
+			s.material.ambient_material = i_ambient;
+			s.material.diffuse_material = i_diffuse;
+			s.material.specular_material = i_specular;
+			s.material.shininess = 16;
+		}
+
+		build_bvh();
+
 	}
 
 };
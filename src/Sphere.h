@@ -4,6 +4,8 @@
 #include <vector>
 #include "Mesh.h"
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
 
 struct RaySphereIntersection{
     bool intersectionExists;
@@ -33,60 +35,66 @@ Vec3 EuclideanCoordinatesToSpherical( Vec3 xyz ) {
 
 
 
-class Sphere : public Mesh {
+// An analytic sphere, for ray tracing : center, radius and material only. Its GL preview is a unit sphere mesh
+// shared by every sphere and placed by the modelview matrix, built by the first draw.
+class Sphere {
 public:
     Vec3 m_center;
     float m_radius;
 
-    Sphere() : Mesh() {}
-    Sphere(Vec3 c , float r) : Mesh() , m_center(c) , m_radius(r) {}
+    Material material;
+
+    Sphere() : m_center(0., 0., 0.) , m_radius(0.f) {}
+    Sphere(Vec3 c , float r) : m_center(c) , m_radius(r) {}
+
+    void draw() const {
+        glPushMatrix();
+        glTranslatef(m_center[0], m_center[1], m_center[2]);
+        glScalef(m_radius, m_radius, m_radius);
+        // the normals of the unit sphere are scaled with it
+        glPushAttrib(GL_ENABLE_BIT);
+        glEnable(GL_RESCALE_NORMAL);
+        unitSphere().draw(material);
+        glPopAttrib();
+        glPopMatrix();
+    }
+
+    // 20 x 20 vertices along the longitude and the latitude, uv as in surface
+    static Mesh const & unitSphere() {
+        static Mesh const mesh = tessellateUnitSphere(20, 20);
+        return mesh;
+    }
 
-    void build_arrays(){
-        unsigned int nTheta = 20 , nPhi = 20;
-        positions_array.resize(3 * nTheta * nPhi );
-        normalsArray.resize(3 * nTheta * nPhi );
-        uvs_array.resize(2 * nTheta * nPhi );
+    static Mesh tessellateUnitSphere(unsigned int nTheta, unsigned int nPhi) {
+        Mesh mesh;
+        mesh.vertices.resize(nTheta * nPhi);
         for( unsigned int thetaIt = 0 ; thetaIt < nTheta ; ++thetaIt ) {
             float u = (float)(thetaIt) / (float)(nTheta-1);
             float theta = u * 2 * M_PI;
             for( unsigned int phiIt = 0 ; phiIt < nPhi ; ++phiIt ) {
-                unsigned int vertexIndex = thetaIt + phiIt * nTheta;
+                MeshVertex & vertex = mesh.vertices[thetaIt + phiIt * nTheta];
                 float v = (float)(phiIt) / (float)(nPhi-1);
                 float phi = - M_PI/2.0 + v * M_PI;
-                Vec3 xyz = SphericalCoordinatesToEuclidean( theta , phi );
-                positions_array[ 3 * vertexIndex + 0 ] = m_center[0] + m_radius * xyz[0];
-                positions_array[ 3 * vertexIndex + 1 ] = m_center[1] + m_radius * xyz[1];
-                positions_array[ 3 * vertexIndex + 2 ] = m_center[2] + m_radius * xyz[2];
-                normalsArray[ 3 * vertexIndex + 0 ] = xyz[0];
-                normalsArray[ 3 * vertexIndex + 1 ] = xyz[1];
-                normalsArray[ 3 * vertexIndex + 2 ] = xyz[2];
-                uvs_array[ 2 * vertexIndex + 0 ] = u;
-                uvs_array[ 2 * vertexIndex + 1 ] = v;
+                vertex.position = vertex.normal = SphericalCoordinatesToEuclidean( theta , phi );
+                vertex.u = u;
+                vertex.v = v;
             }
         }
-        triangles_array.clear();
         for( unsigned int thetaIt = 0 ; thetaIt < nTheta - 1 ; ++thetaIt ) {
             for( unsigned int phiIt = 0 ; phiIt < nPhi - 1 ; ++phiIt ) {
                 unsigned int vertexuv = thetaIt + phiIt * nTheta;
                 unsigned int vertexUv = thetaIt + 1 + phiIt * nTheta;
                 unsigned int vertexuV = thetaIt + (phiIt+1) * nTheta;
                 unsigned int vertexUV = thetaIt + 1 + (phiIt+1) * nTheta;
-                triangles_array.push_back( vertexuv );
-                triangles_array.push_back( vertexUv );
-                triangles_array.push_back( vertexUV );
-                triangles_array.push_back( vertexuv );
-                triangles_array.push_back( vertexUV );
-                triangles_array.push_back( vertexuV );
+                mesh.triangles.push_back( MeshTriangle( vertexuv , vertexUv , vertexUV ) );
+                mesh.triangles.push_back( MeshTriangle( vertexuv , vertexUV , vertexuV ) );
             }
         }
+        return mesh;
     }
 
-
-    RaySphereIntersection intersect(const Ray &ray) const {
-
-        RaySphereIntersection intersection;
-        intersection.intersectionExists = false;
-        intersection.t = FLT_MAX;
+    // Closest root in front of the origin, without the hit point (see surface). tFar is the other root, FLT_MAX if behind.
+    bool hit(const Ray &ray, float & t, float * tFar = NULL) const {
 
         Vec3 origin = ray.origin();
         Vec3 direction = ray.direction();
@@ -97,7 +105,7 @@ public:
 
         float discriminant = b*b - 4*a*c;
         if(discriminant <= 0) {
-            return intersection;
+            return false;
         }
 
         float t1 = (-b - sqrt(discriminant))/(2*a);
@@ -112,15 +120,74 @@ public:
             t2 = tmp;
         }
 
-        if(t1 == FLT_MAX) return intersection;
+        if(t1 == FLT_MAX) return false;
+
+        t = t1;
+        if(tFar != NULL) *tFar = t2;
+        return true;
+    }
+
+    // normal and uv (longitude, latitude as in build_arrays) of a point of the sphere
+    void surface(Vec3 const & p, Vec3 & normal, float & u, float & v) const {
+        normal = (p - m_center) / m_radius;
+        float theta = atan2(normal[1], normal[0]);
+        float phi = asin(std::max(-1.f, std::min(1.f, normal[2])));
+        u = theta < 0.f ? theta / (2 * M_PI) + 1.f : theta / (2 * M_PI);
+        v = phi / M_PI + 0.5f;
+    }
+
+    // Tangent frame at the point of the given normal for normal mapping : u grows eastwards along the parallel, v
+    // northwards, which is cross(normal, tangent). At the poles the parallel is degenerate and any tangent is taken.
+    void tangentFrame(Vec3 const & normal, Vec3 & tangent, float & handedness) const {
+        tangent = Vec3(-normal[1], normal[0], 0.f);
+        if(tangent.squareLength() < 1e-12f) tangent = Vec3(1.f, 0.f, 0.f);
+        tangent.normalize();
+        handedness = 1.f;
+    }
+
+    // Units of texture coordinates per unit of length at the point of the given normal (geometric mean of the two axes) :
+    // u spans a parallel, v a half meridian
+    float uvDensity(Vec3 const & normal) const {
+        float cosPhi = std::max(1e-3f, sqrtf(std::max(0.f, 1.f - normal[2] * normal[2])));
+        return 1.f / (sqrtf(2.f * cosPhi) * (float)M_PI * m_radius);
+    }
+
+    RaySphereIntersection intersect(const Ray &ray) const {
+
+        RaySphereIntersection intersection;
+        intersection.intersectionExists = false;
+        intersection.t = FLT_MAX;
+
+        float t1 , t2;
+        if(!hit(ray, t1, &t2)) return intersection;
 
         intersection.intersectionExists = true;
         intersection.t = t1;
-        intersection.intersection = origin + t1*direction;
-        intersection.secondintersection = origin + t2*direction;
-        intersection.normal = (intersection.intersection - m_center) / m_radius;
+        intersection.intersection = ray.origin() + t1*ray.direction();
+        intersection.secondintersection = ray.origin() + t2*ray.direction();
+        float u , v;
+        surface(intersection.intersection, intersection.normal, u, v);
+        intersection.theta = 2 * M_PI * u;
+        intersection.phi = M_PI * (v - 0.5f);
 
         return intersection;
     }
+
+    // any-hit test for shadow rays : is there a root in [tMin, tMax[ ? No hit point nor normal.
+    bool intersects( const Ray &ray , float tMin , float tMax ) const {
+        Vec3 origin = ray.origin();
+        Vec3 direction = ray.direction();
+
+        float a = Vec3::dot(direction, direction);
+        float b = 2*Vec3::dot(direction, origin - m_center);
+        float c = Vec3::dot(origin, origin) + Vec3::dot(m_center, m_center) - 2*Vec3::dot(origin, m_center) - m_radius*m_radius;
+
+        float discriminant = b*b - 4*a*c;
+        if(discriminant <= 0) return false;
+
+        float t1 = (-b - sqrt(discriminant))/(2*a);
+        float t2 = (-b + sqrt(discriminant))/(2*a);
+        return (t1 >= tMin && t1 < tMax) || (t2 >= tMin && t2 < tMax);
+    }
 };
 #endif
@@ -4,6 +4,7 @@
 #include <vector>
 #include "Mesh.h"
 #include <cmath>
+#include <cfloat>
 
 struct RaySquareIntersection{
     bool intersectionExists;
@@ -56,7 +57,7 @@ public:
         triangles[1][0] = 0;
         triangles[1][1] = 2;
         triangles[1][2] = 3;
-
+        invalidate_arrays();
 
     }
 
@@ -78,11 +79,28 @@ public:
         vertices[0].normal = vertices[1].normal = vertices[2].normal = vertices[3].normal = m_normal;
     }
 
-    RaySquareIntersection intersect(const Ray &ray) const {
-        RaySquareIntersection intersection;
-        intersection.t = FLT_MAX;
-        intersection.intersectionExists = false;
+    // Texture coordinates of the point at (s, t) in [0,1]^2 along the right and up vectors, between the uv of the corners
+    void texCoords(float s, float t, float & u, float & v) const {
+        u = vertices[0].u + s * (vertices[1].u - vertices[0].u);
+        v = vertices[0].v + t * (vertices[3].v - vertices[0].v);
+    }
+
+    // Tangent frame of the quad for normal mapping (see Mesh::recomputeTangents) : the same at every point
+    void tangentFrame(Vec3 & tangent, float & handedness) const {
+        tangent = vertices[0].tangent;
+        handedness = vertices[0].handedness;
+    }
 
+    // Units of texture coordinates per unit of length on the quad (geometric mean of the two axes)
+    float uvDensity() const {
+        float uvArea = fabs((vertices[1].u - vertices[0].u) * (vertices[3].v - vertices[0].v));
+        float area = Vec3::cross(vertices[1].position - vertices[0].position, vertices[3].position - vertices[0].position).length();
+        return area > 0.f ? sqrtf(uvArea / area) : 0.f;
+    }
+
+    // Hit distance and position on the quad (u along the right vector, v along the up vector, in [0,1]),
+    // without the hit point and normal.
+    bool hit(const Ray &ray, float & t, float & u, float & v) const {
         Vec3 origin = ray.origin();
         Vec3 direction = ray.direction();
         Vec3 point = 0.5f*(vertices[0].position + vertices[2].position);
@@ -90,13 +108,13 @@ public:
         float numerator = Vec3::dot(point - origin, m_normal);
         float denominator = Vec3::dot(m_normal, direction);
 
-        if(denominator > -0.0001f) return intersection;
+        if(denominator > -0.0001f) return false;
 
-        float t = numerator/denominator;
+        t = numerator/denominator;
 
-        if(t > 100000.f) return intersection;
+        if(t > 100000.f) return false;
 
-        if(t < 0.0001f) return intersection;
+        if(t < 0.0001f) return false;
 
         Vec3 AB = vertices[1].position - vertices[0].position;
         Vec3 AC = vertices[3].position - vertices[0].position;
@@ -104,15 +122,52 @@ public:
         Vec3 intersectionPoint = origin + t*direction;
         Vec3 AM = intersectionPoint - vertices[0].position;
 
-        if(Vec3::dot(AB, AM) < 0.f || Vec3::dot(AB, AM) > Vec3::dot(AB, AB)) return intersection;
-        if(Vec3::dot(AC, AM) < 0.f || Vec3::dot(AC, AM) > Vec3::dot(AC, AC)) return intersection;
+        float ABAM = Vec3::dot(AB, AM) , ABAB = Vec3::dot(AB, AB);
+        float ACAM = Vec3::dot(AC, AM) , ACAC = Vec3::dot(AC, AC);
+        if(ABAM < 0.f || ABAM > ABAB) return false;
+        if(ACAM < 0.f || ACAM > ACAC) return false;
+
+        u = ABAM / ABAB;
+        v = ACAM / ACAC;
+        return true;
+    }
+
+    RaySquareIntersection intersect(const Ray &ray) const {
+        RaySquareIntersection intersection;
+        intersection.t = FLT_MAX;
+        intersection.intersectionExists = false;
+
+        float t , u , v;
+        if(!hit(ray, t, u, v)) return intersection;
 
         intersection.t = t;
+        intersection.u = u;
+        intersection.v = v;
         intersection.intersectionExists = true;
-        intersection.intersection = intersectionPoint;
+        intersection.intersection = ray.origin() + t*ray.direction();
         intersection.normal = m_normal;
 
         return intersection;
     }
+
+    // any-hit test for shadow rays, same conditions as intersect() within [tMin, tMax[
+    bool intersects( const Ray &ray , float tMin , float tMax ) const {
+        Vec3 origin = ray.origin();
+        Vec3 direction = ray.direction();
+        Vec3 point = 0.5f*(vertices[0].position + vertices[2].position);
+
+        float denominator = Vec3::dot(m_normal, direction);
+        if(denominator > -0.0001f) return false;
+
+        float t = Vec3::dot(point - origin, m_normal)/denominator;
+        if(t > 100000.f || t < 0.0001f || t < tMin || t >= tMax) return false;
+
+        Vec3 AB = vertices[1].position - vertices[0].position;
+        Vec3 AC = vertices[3].position - vertices[0].position;
+        Vec3 AM = origin + t*direction - vertices[0].position;
+
+        float u = Vec3::dot(AB, AM) , v = Vec3::dot(AC, AM);
+        return u >= 0.f && u <= Vec3::dot(AB, AB) && v >= 0.f && v <= Vec3::dot(AC, AC);
+    }
 };
 #endif // SQUARE_H
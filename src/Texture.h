@@ -0,0 +1,413 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+
+#include "Vec3.h"
+#include "imageLoader.h"
+
+// -------------------------------------------
+// Filtered textures for the ray tracer.
+// A texture is a mip pyramid built at load time with a 2x2 box filter. Every level is stored as 4x4 tiles of RGBA8
+// texels, 64 bytes each (one cache line) : the 4 texels of a bilinear fetch share a line in most cases, and so do the
+// fetches of neighbouring rays. The level of a fetch comes from the footprint of the ray cone at the hit (see RayCone) :
+// far or grazing surfaces read small, averaged levels instead of aliasing on the full resolution image.
+// Texture coordinates repeat in u and v.
+// A texture can then be compressed in place, every 4x4 tile becoming one block whose palette is decoded at fetch time :
+//  - BC1 for colors : two RGB565 end points and 2 bit indices, 8 bytes a block (8 times smaller);
+//  - BC5 for normal maps : x and y as two BC4 blocks (two 8 bit end points and 3 bit indices each), z being
+//    rebuilt from the unit length of the normal, 16 bytes a block (4 times smaller).
+// -------------------------------------------
+
+// Cone around a ray : width of the cone at the origin of the ray, and its spread angle (radians).
+// Camera rays start with a zero width and the spread of one pixel.
+struct RayCone {
+    float width , spread;
+
+    RayCone( float w = 0.f , float s = 0.f ) : width( w ) , spread( s ) {}
+
+    float widthAt( float t ) const { return width + t * spread; }
+};
+
+static const unsigned int TEXTURE_TILE = 4;
+
+enum TextureFormat {
+    Texture_RGBA8 ,
+    Texture_BC1 ,
+    Texture_BC5
+};
+
+class Texture {
+public:
+    Texture() : m_width( 0 ) , m_height( 0 ) , m_format( Texture_RGBA8 ) , m_normalMap( false ) {}
+
+    // Loads a PPM image and builds its pyramid. Returns false, leaving the texture empty, if the image could not be read.
+    bool load( std::string const & filename ) {
+        ppmLoader::ImageRGB image;
+        if( !ppmLoader::load_ppm( image , filename ) ) return false;
+        build( (unsigned char const *)image.pixels() , image.w , image.h );
+        return true;
+    }
+
+    // rgb : w * h RGB8 texels, row by row
+    void build( unsigned char const * rgb , unsigned int w , unsigned int h ) {
+        m_width = w;
+        m_height = h;
+        m_format = Texture_RGBA8;
+        m_levels.clear();
+        std::vector< uint32_t > texels( w * h );
+        for( unsigned int i = 0 ; i < w * h ; ++i )
+            texels[i] = pack( rgb[3 * i + 0] , rgb[3 * i + 1] , rgb[3 * i + 2] );
+        for( ; ; ) {
+            addLevel( texels , w , h );
+            if( w == 1 && h == 1 ) break;
+            texels = downsample( texels , w , h );
+            w = std::max( 1u , w / 2 );
+            h = std::max( 1u , h / 2 );
+        }
+    }
+
+    bool empty() const { return m_levels.empty(); }
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    unsigned int levels() const { return (unsigned int)m_levels.size(); }
+    TextureFormat format() const { return m_format; }
+
+    // A normal map is compressed as BC5 instead of BC1 (see compress)
+    bool isNormalMap() const { return m_normalMap; }
+    void setNormalMap( bool normalMap ) { m_normalMap = normalMap; }
+
+    // Block compression of every level of an uncompressed texture, BC5 for a normal map and BC1 otherwise
+    void compress() {
+        if( m_format != Texture_RGBA8 ) return;
+        m_format = m_normalMap ? Texture_BC5 : Texture_BC1;
+        unsigned int stride = m_format == Texture_BC5 ? 2 : 1;
+        for( unsigned int l = 0 ; l < levels() ; ++l ) {
+            Level & level = m_levels[l];
+            level.blocks.resize( stride * level.tiles.size() );
+            for( unsigned int b = 0 ; b < level.tiles.size() ; ++b ) {
+                // texels past the border repeat the last row and column, so that they do not pull the end points
+                uint32_t texels[TEXTURE_TILE * TEXTURE_TILE];
+                unsigned int x0 = ( b % level.tilesX ) * TEXTURE_TILE , y0 = ( b / level.tilesX ) * TEXTURE_TILE;
+                for( unsigned int i = 0 ; i < TEXTURE_TILE * TEXTURE_TILE ; ++i )
+                    texels[i] = level.fetch( std::min( x0 + i % TEXTURE_TILE , level.width - 1 ) , std::min( y0 + i / TEXTURE_TILE , level.height - 1 ) );
+                if( m_format == Texture_BC1 ) {
+                    level.blocks[b] = encodeBC1( texels );
+                } else {
+                    level.blocks[2 * b] = encodeBC4( texels , 0 );
+                    level.blocks[2 * b + 1] = encodeBC4( texels , 1 );
+                }
+            }
+            level.format = m_format;
+            std::vector< TexelTile >().swap( level.tiles );
+        }
+    }
+
+    // Bytes taken by the levels, and the same levels stored uncompressed
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for( unsigned int l = 0 ; l < levels() ; ++l )
+            bytes += m_levels[l].tiles.size() * sizeof( TexelTile ) + m_levels[l].blocks.size() * sizeof( uint64_t );
+        return bytes;
+    }
+    size_t uncompressedBytes() const {
+        size_t bytes = 0;
+        for( unsigned int l = 0 ; l < levels() ; ++l )
+            bytes += m_levels[l].tilesX * ( ( m_levels[l].height + TEXTURE_TILE - 1 ) / TEXTURE_TILE ) * sizeof( TexelTile );
+        return bytes;
+    }
+
+    // Average time of a trilinear fetch (nanoseconds), over count fetches at pseudo random coordinates and levels
+    double fetchCost( unsigned int count = 1 << 15 ) const {
+        if( empty() ) return 0.0;
+        uint32_t state = 12345u;
+        float sum = 0.f;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( unsigned int i = 0 ; i < count ; ++i ) {
+            state = state * 1664525u + 1013904223u;
+            float u = ( state >> 8 ) * ( 1.f / 16777216.f );
+            state = state * 1664525u + 1013904223u;
+            float v = ( state >> 8 ) * ( 1.f / 16777216.f );
+            sum += sample( u , v , ( i % 5 ) * 0.5f )[0];
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        // keeps the fetches alive
+        if( sum < 0.f ) return 0.0;
+        return std::chrono::duration< double , std::nano >( end - start ).count() / count;
+    }
+
+    // Texels of level 0 per unit of texture coordinates (geometric mean of the two axes)
+    float resolution() const { return sqrtf( (float)m_width * (float)m_height ); }
+
+    // Level of detail of a fetch whose footprint spans the given number of texels of level 0
+    float level( float footprint ) const {
+        if( !( footprint > 1.f ) ) return 0.f;
+        return std::min( log2f( footprint ) , (float)( levels() - 1 ) );
+    }
+
+    // Trilinear fetch : bilinear in the two levels around lod, blended
+    Vec3 sample( float u , float v , float lod ) const {
+        if( empty() ) return Vec3( 1.f , 1.f , 1.f );
+        unsigned int l0 = (unsigned int)lod;
+        float blend = lod - l0;
+        Vec3 color = bilinear( m_levels[l0] , u , v );
+        if( blend > 0.f && l0 + 1 < levels() )
+            color = ( 1.f - blend ) * color + blend * bilinear( m_levels[l0 + 1] , u , v );
+        return color;
+    }
+
+private:
+    struct alignas( 64 ) TexelTile {
+        uint32_t texels[TEXTURE_TILE * TEXTURE_TILE];
+    };
+
+    // Texels of a level : tiles of an uncompressed texture, blocks of a compressed one (two per tile for BC5)
+    struct Level {
+        unsigned int width , height , tilesX;
+        TextureFormat format;
+        std::vector< TexelTile > tiles;
+        std::vector< uint64_t > blocks;
+
+        // texel of an uncompressed level
+        uint32_t fetch( unsigned int x , unsigned int y ) const {
+            return tiles[( y / TEXTURE_TILE ) * tilesX + x / TEXTURE_TILE].texels[( y % TEXTURE_TILE ) * TEXTURE_TILE + x % TEXTURE_TILE];
+        }
+
+        // The 2x2 texels of a bilinear fetch, in the order (x0,y0) (x1,y0) (x0,y1) (x1,y1). The palette of a block is
+        // decoded once for the texels that fall in it.
+        void fetchQuad( unsigned int x0 , unsigned int x1 , unsigned int y0 , unsigned int y1 , uint32_t * texels ) const {
+            unsigned int xs[4] = { x0 , x1 , x0 , x1 } , ys[4] = { y0 , y0 , y1 , y1 };
+            if( format == Texture_RGBA8 ) {
+                for( unsigned int k = 0 ; k < 4 ; ++k ) texels[k] = fetch( xs[k] , ys[k] );
+                return;
+            }
+            unsigned int decoded = ~0u;
+            uint32_t colors[4];
+            unsigned char xValues[8] , yValues[8];
+            for( unsigned int k = 0 ; k < 4 ; ++k ) {
+                unsigned int tile = ( ys[k] / TEXTURE_TILE ) * tilesX + xs[k] / TEXTURE_TILE;
+                unsigned int texel = ( ys[k] % TEXTURE_TILE ) * TEXTURE_TILE + xs[k] % TEXTURE_TILE;
+                if( format == Texture_BC1 ) {
+                    if( tile != decoded ) paletteBC1( blocks[tile] , colors );
+                    texels[k] = colors[( blocks[tile] >> ( 32 + 2 * texel ) ) & 3];
+                } else {
+                    if( tile != decoded ) {
+                        paletteBC4( blocks[2 * tile] , xValues );
+                        paletteBC4( blocks[2 * tile + 1] , yValues );
+                    }
+                    texels[k] = normalTexel( xValues[( blocks[2 * tile] >> ( 16 + 3 * texel ) ) & 7] , yValues[( blocks[2 * tile + 1] >> ( 16 + 3 * texel ) ) & 7] );
+                }
+                decoded = tile;
+            }
+        }
+    };
+
+    // BC1 : end points c0 (bits 0-15) and c1 (16-31) in RGB565, then 2 bits per texel, indices in the palette. c0 > c1
+    // gives 4 colors, c0 and c1 and two interpolated ones; c0 <= c1 gives c0, c1, their mean and black.
+    static void paletteBC1( uint64_t block , uint32_t * palette ) {
+        unsigned int c0 = block & 0xffff , c1 = ( block >> 16 ) & 0xffff;
+        palette[0] = expand565( c0 );
+        palette[1] = expand565( c1 );
+        unsigned int a[3] , b[3];
+        for( unsigned int c = 0 ; c < 3 ; ++c ) {
+            a[c] = channel( palette[0] , c );
+            b[c] = channel( palette[1] , c );
+        }
+        if( c0 > c1 ) {
+            palette[2] = pack( ( 2 * a[0] + b[0] ) / 3 , ( 2 * a[1] + b[1] ) / 3 , ( 2 * a[2] + b[2] ) / 3 );
+            palette[3] = pack( ( a[0] + 2 * b[0] ) / 3 , ( a[1] + 2 * b[1] ) / 3 , ( a[2] + 2 * b[2] ) / 3 );
+        } else {
+            palette[2] = pack( ( a[0] + b[0] ) / 2 , ( a[1] + b[1] ) / 2 , ( a[2] + b[2] ) / 2 );
+            palette[3] = pack( 0 , 0 , 0 );
+        }
+    }
+
+    static uint32_t expand565( unsigned int c ) {
+        unsigned int r = ( c >> 11 ) & 31 , g = ( c >> 5 ) & 63 , b = c & 31;
+        return pack( ( r << 3 ) | ( r >> 2 ) , ( g << 2 ) | ( g >> 4 ) , ( b << 3 ) | ( b >> 2 ) );
+    }
+
+    // End points along the principal axis of the colors of the block, each texel taking the closest of the 4 colors
+    static uint64_t encodeBC1( uint32_t const * texels ) {
+        const unsigned int n = TEXTURE_TILE * TEXTURE_TILE;
+        float mean[3] = { 0.f , 0.f , 0.f };
+        for( unsigned int i = 0 ; i < n ; ++i )
+            for( unsigned int c = 0 ; c < 3 ; ++c ) mean[c] += channel( texels[i] , c ) / (float)n;
+        float covariance[3][3] = { { 0.f } };
+        for( unsigned int i = 0 ; i < n ; ++i )
+            for( unsigned int a = 0 ; a < 3 ; ++a )
+                for( unsigned int b = 0 ; b < 3 ; ++b )
+                    covariance[a][b] += ( channel( texels[i] , a ) - mean[a] ) * ( channel( texels[i] , b ) - mean[b] );
+        // power iterations, from the luminance axis
+        float axis[3] = { 0.3f , 0.6f , 0.1f };
+        for( unsigned int k = 0 ; k < 4 ; ++k ) {
+            float next[3] , length = 0.f;
+            for( unsigned int a = 0 ; a < 3 ; ++a ) {
+                next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+                length += next[a] * next[a];
+            }
+            if( length < 1e-12f ) break;
+            length = sqrtf( length );
+            for( unsigned int a = 0 ; a < 3 ; ++a ) axis[a] = next[a] / length;
+        }
+        float lo = FLT_MAX , hi = -FLT_MAX;
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            float t = 0.f;
+            for( unsigned int c = 0 ; c < 3 ; ++c ) t += ( channel( texels[i] , c ) - mean[c] ) * axis[c];
+            lo = std::min( lo , t );
+            hi = std::max( hi , t );
+        }
+        unsigned int c0 = quantize565( mean , axis , hi ) , c1 = quantize565( mean , axis , lo );
+        if( c0 < c1 ) std::swap( c0 , c1 );
+        uint64_t block = c0 | ( c1 << 16 );
+        if( c0 == c1 ) return block;
+        uint32_t palette[4];
+        paletteBC1( block , palette );
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            unsigned int best = 0 , bestDistance = ~0u;
+            for( unsigned int k = 0 ; k < 4 ; ++k ) {
+                unsigned int distance = 0;
+                for( unsigned int c = 0 ; c < 3 ; ++c ) {
+                    int d = (int)channel( texels[i] , c ) - (int)channel( palette[k] , c );
+                    distance += d * d;
+                }
+                if( distance < bestDistance ) {
+                    bestDistance = distance;
+                    best = k;
+                }
+            }
+            block |= (uint64_t)best << ( 32 + 2 * i );
+        }
+        return block;
+    }
+
+    static unsigned int quantize565( float const * mean , float const * axis , float t ) {
+        unsigned int q[3];
+        const float levels[3] = { 31.f , 63.f , 31.f };
+        for( unsigned int c = 0 ; c < 3 ; ++c ) {
+            float value = std::max( 0.f , std::min( 255.f , mean[c] + t * axis[c] ) );
+            q[c] = (unsigned int)( value / 255.f * levels[c] + 0.5f );
+        }
+        return ( q[0] << 11 ) | ( q[1] << 5 ) | q[2];
+    }
+
+    // BC4 : end points r0 (bits 0-7) and r1 (8-15), then 3 bits per texel, indices in the palette. r0 > r1 gives r0, r1
+    // and 6 interpolated values; r0 <= r1 gives r0, r1, 4 interpolated values, 0 and 255.
+    static void paletteBC4( uint64_t block , unsigned char * palette ) {
+        unsigned int r0 = block & 0xff , r1 = ( block >> 8 ) & 0xff;
+        palette[0] = r0;
+        palette[1] = r1;
+        if( r0 > r1 ) {
+            for( unsigned int k = 2 ; k < 8 ; ++k ) palette[k] = ( ( 8 - k ) * r0 + ( k - 1 ) * r1 ) / 7;
+        } else {
+            for( unsigned int k = 2 ; k < 6 ; ++k ) palette[k] = ( ( 6 - k ) * r0 + ( k - 1 ) * r1 ) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    static uint64_t encodeBC4( uint32_t const * texels , unsigned int c ) {
+        const unsigned int n = TEXTURE_TILE * TEXTURE_TILE;
+        unsigned int lo = 255 , hi = 0;
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            lo = std::min( lo , channel( texels[i] , c ) );
+            hi = std::max( hi , channel( texels[i] , c ) );
+        }
+        uint64_t block = hi | ( lo << 8 );
+        if( hi == lo ) return block;
+        unsigned char palette[8];
+        paletteBC4( block , palette );
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            unsigned int value = channel( texels[i] , c ) , best = 0 , bestDistance = ~0u;
+            for( unsigned int k = 0 ; k < 8 ; ++k ) {
+                unsigned int decoded = palette[k];
+                unsigned int distance = value > decoded ? value - decoded : decoded - value;
+                if( distance < bestDistance ) {
+                    bestDistance = distance;
+                    best = k;
+                }
+            }
+            block |= (uint64_t)best << ( 16 + 3 * i );
+        }
+        return block;
+    }
+
+    // Texel of a BC5 normal map from its x and y, z = sqrt( 1 - x^2 - y^2 ) being stored back as a color
+    static uint32_t normalTexel( unsigned int r , unsigned int g ) {
+        float nx = r * ( 2.f / 255.f ) - 1.f , ny = g * ( 2.f / 255.f ) - 1.f;
+        float nz = sqrtf( std::max( 0.f , 1.f - nx * nx - ny * ny ) );
+        return pack( r , g , (unsigned int)( ( 0.5f * nz + 0.5f ) * 255.f + 0.5f ) );
+    }
+
+    static uint32_t pack( unsigned int r , unsigned int g , unsigned int b ) { return r | ( g << 8 ) | ( b << 16 ) | ( 255u << 24 ); }
+    static unsigned int channel( uint32_t texel , unsigned int c ) { return ( texel >> ( 8 * c ) ) & 0xff; }
+
+    void addLevel( std::vector< uint32_t > const & texels , unsigned int w , unsigned int h ) {
+        Level level;
+        level.width = w;
+        level.height = h;
+        level.format = Texture_RGBA8;
+        level.tilesX = ( w + TEXTURE_TILE - 1 ) / TEXTURE_TILE;
+        level.tiles.resize( level.tilesX * ( ( h + TEXTURE_TILE - 1 ) / TEXTURE_TILE ) );
+        // texels past the border of the image are never fetched
+        for( unsigned int y = 0 ; y < h ; ++y )
+            for( unsigned int x = 0 ; x < w ; ++x )
+                level.tiles[( y / TEXTURE_TILE ) * level.tilesX + x / TEXTURE_TILE].texels[( y % TEXTURE_TILE ) * TEXTURE_TILE + x % TEXTURE_TILE] = texels[x + y * w];
+        m_levels.push_back( level );
+    }
+
+    // Next level of the pyramid : each texel averages a 2x2 block (the last row or column of an odd size is repeated)
+    static std::vector< uint32_t > downsample( std::vector< uint32_t > const & texels , unsigned int w , unsigned int h ) {
+        unsigned int w2 = std::max( 1u , w / 2 ) , h2 = std::max( 1u , h / 2 );
+        std::vector< uint32_t > result( w2 * h2 );
+        for( unsigned int y = 0 ; y < h2 ; ++y ) {
+            unsigned int y0 = std::min( 2 * y , h - 1 ) , y1 = std::min( 2 * y + 1 , h - 1 );
+            for( unsigned int x = 0 ; x < w2 ; ++x ) {
+                unsigned int x0 = std::min( 2 * x , w - 1 ) , x1 = std::min( 2 * x + 1 , w - 1 );
+                unsigned int sum[3];
+                for( unsigned int c = 0 ; c < 3 ; ++c )
+                    sum[c] = channel( texels[x0 + y0 * w] , c ) + channel( texels[x1 + y0 * w] , c ) +
+                             channel( texels[x0 + y1 * w] , c ) + channel( texels[x1 + y1 * w] , c ) + 2;
+                result[x + y * w2] = pack( sum[0] / 4 , sum[1] / 4 , sum[2] / 4 );
+            }
+        }
+        return result;
+    }
+
+    static Vec3 bilinear( Level const & level , float u , float v ) {
+        // v = 0 is the bottom row of the image
+        float x = u * level.width - 0.5f , y = ( 1.f - v ) * level.height - 0.5f;
+        float fx = floorf( x ) , fy = floorf( y );
+        float ax = x - fx , ay = y - fy;
+        unsigned int x0 = wrap( (long long)fx , level.width ) , x1 = wrap( (long long)fx + 1 , level.width );
+        unsigned int y0 = wrap( (long long)fy , level.height ) , y1 = wrap( (long long)fy + 1 , level.height );
+        uint32_t texels[4];
+        level.fetchQuad( x0 , x1 , y0 , y1 , texels );
+        uint32_t t00 = texels[0] , t10 = texels[1] , t01 = texels[2] , t11 = texels[3];
+        Vec3 color;
+        for( unsigned int c = 0 ; c < 3 ; ++c ) {
+            float top = ( 1.f - ax ) * channel( t00 , c ) + ax * channel( t10 , c );
+            float bottom = ( 1.f - ax ) * channel( t01 , c ) + ax * channel( t11 , c );
+            color[c] = ( ( 1.f - ay ) * top + ay * bottom ) * ( 1.f / 255.f );
+        }
+        return color;
+    }
+
+    static unsigned int wrap( long long i , unsigned int size ) {
+        long long m = i % (long long)size;
+        return (unsigned int)( m < 0 ? m + size : m );
+    }
+
+    unsigned int m_width , m_height;
+    TextureFormat m_format;
+    bool m_normalMap;
+    std::vector< Level > m_levels;
+};
+
+#endif // TEXTURE_H
@@ -0,0 +1,86 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool( unsigned int nThreads ) : queues( nThreads == 0 ? ( std::thread::hardware_concurrency() == 0 ? 1 : std::thread::hardware_concurrency() ) : nThreads ) ,
+    currentJob( NULL ) , batchId( 0 ) , activeWorkers( 0 ) , stopping( false ) {
+    for( unsigned int w = 0 ; w < queues.size() ; ++w )
+        workers.push_back( std::thread( &ThreadPool::workerLoop , this , w ) );
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock< std::mutex > guard( batchLock );
+        stopping = true;
+    }
+    batchStart.notify_all();
+    for( unsigned int w = 0 ; w < workers.size() ; ++w )
+        workers[w].join();
+}
+
+void ThreadPool::parallel_for( unsigned int nJobs , std::function< void( unsigned int , unsigned int ) > const & job ) {
+    if( nJobs == 0 ) return;
+
+    // contiguous blocks keep neighbouring tiles on the same worker as long as nobody needs to steal them
+    unsigned int nWorkers = size();
+    for( unsigned int w = 0 ; w < nWorkers ; ++w ) {
+        unsigned int begin = ( nJobs * w ) / nWorkers , end = ( nJobs * ( w + 1 ) ) / nWorkers;
+        std::unique_lock< std::mutex > guard( queues[w].lock );
+        for( unsigned int j = begin ; j < end ; ++j )
+            queues[w].jobs.push_back( j );
+    }
+
+    std::unique_lock< std::mutex > guard( batchLock );
+    currentJob = &job;
+    activeWorkers = nWorkers;
+    ++batchId;
+    batchStart.notify_all();
+    batchEnd.wait( guard , [this]{ return activeWorkers == 0; } );
+    currentJob = NULL;
+}
+
+bool ThreadPool::popJob( unsigned int worker , unsigned int & job ) {
+    {
+        WorkQueue & own = queues[worker];
+        std::unique_lock< std::mutex > guard( own.lock );
+        if( !own.jobs.empty() ) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+    unsigned int nWorkers = size();
+    for( unsigned int i = 1 ; i < nWorkers ; ++i ) {
+        WorkQueue & victim = queues[( worker + i ) % nWorkers];
+        std::unique_lock< std::mutex > guard( victim.lock );
+        if( !victim.jobs.empty() ) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runBatch( unsigned int worker ) {
+    // no job is pushed while a batch runs : once every queue is empty, this worker is done
+    unsigned int job;
+    while( popJob( worker , job ) )
+        ( *currentJob )( job , worker );
+}
+
+void ThreadPool::workerLoop( unsigned int worker ) {
+    unsigned int lastBatch = 0;
+    while( true ) {
+        {
+            std::unique_lock< std::mutex > guard( batchLock );
+            batchStart.wait( guard , [&]{ return stopping || batchId != lastBatch; } );
+            if( stopping ) return;
+            lastBatch = batchId;
+        }
+        runBatch( worker );
+        {
+            std::unique_lock< std::mutex > guard( batchLock );
+            if( --activeWorkers == 0 )
+                batchEnd.notify_one();
+        }
+    }
+}
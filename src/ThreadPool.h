@@ -0,0 +1,51 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// -------------------------------------------
+// Work-stealing thread pool.
+// Jobs of a batch are dealt in contiguous blocks to per-worker queues.
+// A worker pops from the back of its own queue and, once it is empty,
+// steals from the front of the other queues.
+// -------------------------------------------
+
+class ThreadPool {
+public:
+    // nThreads == 0 : one worker per hardware thread
+    explicit ThreadPool( unsigned int nThreads = 0 );
+    ~ThreadPool();
+
+    unsigned int size() const { return (unsigned int)queues.size(); }
+
+    // Runs job( jobIndex , workerIndex ) for every jobIndex in [0,nJobs) and blocks until all are done.
+    // workerIndex is in [0,size()) and can be used to index per-thread scratch data.
+    void parallel_for( unsigned int nJobs , std::function< void( unsigned int , unsigned int ) > const & job );
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque< unsigned int > jobs;
+    };
+
+    bool popJob( unsigned int worker , unsigned int & job );
+    void runBatch( unsigned int worker );
+    void workerLoop( unsigned int worker );
+
+    std::vector< WorkQueue > queues;
+    std::vector< std::thread > workers;
+
+    std::mutex batchLock;
+    std::condition_variable batchStart , batchEnd;
+    std::function< void( unsigned int , unsigned int ) > const * currentJob;
+    unsigned int batchId;
+    unsigned int activeWorkers;
+    bool stopping;
+};
+
+#endif // THREADPOOL_H
@@ -3,16 +3,74 @@
 #include "Vec3.h"
 #include "Ray.h"
 #include "Plane.h"
+#include <cfloat>
+#include <utility>
 
 struct RayTriangleIntersection{
     bool intersectionExists;
     float t;
     float w0,w1,w2;
     unsigned int tIndex;
+    float u,v;
     Vec3 intersection;
     Vec3 normal;
 };
 
+// Per ray part of the watertight ray/triangle test (Woop, Benthin, Wald 2013):
+// the ray is sheared so that it becomes the +z axis, and the test reduces to 2D edge functions.
+// Triangles sharing an edge compute the same edge function for it, so no ray can slip between them.
+struct WatertightRay {
+    Vec3 origin;
+    int kx , ky , kz;
+    float Sx , Sy , Sz;
+
+    WatertightRay( Ray const & ray ) : origin( ray.origin() ) {
+        Vec3 const & d = ray.direction();
+        kz = 0;
+        if( fabs( d[1] ) > fabs( d[kz] ) ) kz = 1;
+        if( fabs( d[2] ) > fabs( d[kz] ) ) kz = 2;
+        kx = ( kz + 1 ) % 3;
+        ky = ( kx + 1 ) % 3;
+        // keeps the winding of the triangles
+        if( d[kz] < 0.f ) std::swap( kx , ky );
+        Sx = d[kx] / d[kz];
+        Sy = d[ky] / d[kz];
+        Sz = 1.f / d[kz];
+    }
+};
+
+// Hit in ]tMin, tMax[ : t and the barycentric weights of c0, c1, c2. Both sides of the triangle are hit.
+static inline bool intersect_triangle_watertight( WatertightRay const & ray , Vec3 const & c0 , Vec3 const & c1 , Vec3 const & c2 ,
+                                                  float tMin , float tMax , float & t , float & w0 , float & w1 , float & w2 ) {
+    Vec3 A = c0 - ray.origin , B = c1 - ray.origin , C = c2 - ray.origin;
+    float Ax = A[ray.kx] - ray.Sx * A[ray.kz] , Ay = A[ray.ky] - ray.Sy * A[ray.kz];
+    float Bx = B[ray.kx] - ray.Sx * B[ray.kz] , By = B[ray.ky] - ray.Sy * B[ray.kz];
+    float Cx = C[ray.kx] - ray.Sx * C[ray.kz] , Cy = C[ray.ky] - ray.Sy * C[ray.kz];
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+    // on an edge : the float products may have lost the sign, redo them in double
+    if( U == 0.f || V == 0.f || W == 0.f ) {
+        U = (float)( (double)Cx * (double)By - (double)Cy * (double)Bx );
+        V = (float)( (double)Ax * (double)Cy - (double)Ay * (double)Cx );
+        W = (float)( (double)Bx * (double)Ay - (double)By * (double)Ax );
+    }
+    if( ( U < 0.f || V < 0.f || W < 0.f ) && ( U > 0.f || V > 0.f || W > 0.f ) ) return false;
+    float det = U + V + W;
+    if( det == 0.f ) return false;
+    float Az = ray.Sz * A[ray.kz] , Bz = ray.Sz * B[ray.kz] , Cz = ray.Sz * C[ray.kz];
+    float T = U * Az + V * Bz + W * Cz;
+    // T / det in ]tMin, tMax[ without dividing yet
+    float absDet = fabs( det ) , signedT = det < 0.f ? -T : T;
+    if( signedT <= tMin * absDet || signedT >= tMax * absDet ) return false;
+    float invDet = 1.f / det;
+    t = T * invDet;
+    w0 = U * invDet;
+    w1 = V * invDet;
+    w2 = W * invDet;
+    return true;
+}
+
 class Triangle {
 private:
     Vec3 m_c[3] , m_normal;
@@ -36,42 +94,44 @@ public:
     void setC2( Vec3 const & c2 ) { m_c[2] = c2; } // remember to update the area and normal afterwards!
     Vec3 const & normal() const { return m_normal; }
     Vec3 projectOnSupportPlane( Vec3 const & p ) const {
-        Vec3 result;
-        //TODO completer
-        return result;
+        return p - Vec3::dot( p - m_c[0] , m_normal ) * m_normal;
     }
     float squareDistanceToSupportPlane( Vec3 const & p ) const {
-        float result;
-        //TODO completer
-        return result;
+        float d = Vec3::dot( p - m_c[0] , m_normal );
+        return d * d;
     }
     float distanceToSupportPlane( Vec3 const & p ) const { return sqrt( squareDistanceToSupportPlane(p) ); }
     bool isParallelTo( Line const & L ) const {
-        bool result;
-        //TODO completer
-        return result;
+        return fabs( Vec3::dot( L.direction() , m_normal ) ) < 1e-8f;
     }
     Vec3 getIntersectionPointWithSupportPlane( Line const & L ) const {
         // you should check first that the line is not parallel to the plane!
-        Vec3 result;
-        //TODO completer
-        return result;
+        float t = Vec3::dot( m_c[0] - L.origin() , m_normal ) / Vec3::dot( L.direction() , m_normal );
+        return L.origin() + t * L.direction();
     }
+    // p = u0*c0 + u1*c1 + u2*c2, for p on the support plane
     void computeBarycentricCoordinates( Vec3 const & p , float & u0 , float & u1 , float & u2 ) const {
-        //TODO Complete
+        float twiceArea = 2.f * area;
+        u0 = Vec3::dot( Vec3::cross( m_c[1] - p , m_c[2] - p ) , m_normal ) / twiceArea;
+        u1 = Vec3::dot( Vec3::cross( m_c[2] - p , m_c[0] - p ) , m_normal ) / twiceArea;
+        u2 = 1.f - u0 - u1;
     }
 
     RayTriangleIntersection getIntersection( Ray const & ray ) const {
         RayTriangleIntersection result;
-        // 1) check that the ray is not parallel to the triangle:
-
-        // 2) check that the triangle is "in front of" the ray:
-
-        // 3) check that the intersection point is inside the triangle:
-        // CONVENTION: compute u,v such that p = w0*c0 + w1*c1 + w2*c2, check that 0 <= w0,w1,w2 <= 1
-
-        // 4) Finally, if all conditions were met, then there is an intersection! :
-
+        result.intersectionExists = false;
+        result.t = FLT_MAX;
+        // CONVENTION: p = w0*c0 + w1*c1 + w2*c2, with 0 <= w0,w1,w2 <= 1
+        float t , w0 , w1 , w2;
+        if( !intersect_triangle_watertight( WatertightRay( ray ) , m_c[0] , m_c[1] , m_c[2] , 0.f , FLT_MAX , t , w0 , w1 , w2 ) )
+            return result;
+        result.intersectionExists = true;
+        result.t = t;
+        result.w0 = w0;
+        result.w1 = w1;
+        result.w2 = w2;
+        result.intersection = ray.origin() + t * ray.direction();
+        result.normal = m_normal;
         return result;
     }
 };
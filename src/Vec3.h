@@ -5,6 +5,16 @@
 #include <cstdlib>
 #include <iostream>
 
+// Build with -DVEC3_SIMD to store Vec3 as one aligned SSE register (4 floats, the 4th one unused).
+// The two builds agree within a tolerance, not to the last bit : normalize() uses the reciprocal square root
+// estimate refined once (about 1e-7 relative error), and the compiler may contract the scalar code into FMAs
+// (-march=native). Renders differ by a few 1e-3 at most, at pixels where a ray grazes an edge ; make check-simd
+// compares the two builds on a few scenes.
+#if defined(VEC3_SIMD) && defined(__SSE2__)
+#define VEC3_USE_SSE
+#include <emmintrin.h>
+#endif
+
 class Vec3;
 static inline Vec3 operator + (Vec3 const & a , Vec3 const & b);
 static inline Vec3 operator * (float a , Vec3 const & b);
@@ -12,27 +22,65 @@ static inline Vec3 operator * (Vec3 const & a , Vec3 const & b);
 
 class Vec3 {
 private:
+#ifdef VEC3_USE_SSE
+    union {
+        __m128 mSimd;
+        float mVals[4];
+    };
+#else
     float mVals[3];
+#endif
 public:
+#ifdef VEC3_USE_SSE
+    Vec3() : mSimd( _mm_setzero_ps() ) {}
+    Vec3( float x , float y , float z ) : mSimd( _mm_setr_ps( x , y , z , 0.f ) ) {}
+    explicit Vec3( __m128 v ) : mSimd( v ) {}
+    __m128 simd() const { return mSimd; }
+#else
     Vec3() {mVals[0] = mVals[1] = mVals[2] = 0.f;}
     Vec3( float x , float y , float z ) {
        mVals[0] = x; mVals[1] = y; mVals[2] = z;
     }
+#endif
     float & operator [] (unsigned int c) { return mVals[c]; }
     float operator [] (unsigned int c) const { return mVals[c]; }
-    Vec3 operator = (Vec3 const & other) {
-       mVals[0] = other[0] ; mVals[1] = other[1]; mVals[2] = other[2];
-       return *this;
-    }
-    float squareLength() const {
-       return mVals[0]*mVals[0] + mVals[1]*mVals[1] + mVals[2]*mVals[2];
-    }
+    float squareLength() const { return dot( *this , *this ); }
     float length() const { return sqrt( squareLength() ); }
     inline
     float norm() const { return length(); }
     inline
     float squareNorm() const { return squareLength(); }
-    void normalize() { float L = length(); mVals[0] /= L; mVals[1] /= L; mVals[2] /= L; }
+#ifdef VEC3_USE_SSE
+    void normalize() {
+        // one Newton-Raphson step on the 12 bit estimate
+        __m128 L2 = _mm_set1_ps( squareLength() );
+        __m128 r = _mm_rsqrt_ps( L2 );
+        r = _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 0.5f ) , r ) , _mm_sub_ps( _mm_set1_ps( 3.f ) , _mm_mul_ps( _mm_mul_ps( L2 , r ) , r ) ) );
+        mSimd = _mm_mul_ps( mSimd , r );
+    }
+    static float dot( Vec3 const & a , Vec3 const & b ) {
+       __m128 m = _mm_mul_ps( a.mSimd , b.mSimd );
+       __m128 y = _mm_shuffle_ps( m , m , _MM_SHUFFLE( 1 , 1 , 1 , 1 ) );
+       __m128 z = _mm_movehl_ps( m , m );
+       return _mm_cvtss_f32( _mm_add_ss( _mm_add_ss( m , y ) , z ) );
+    }
+    static Vec3 clamp(Vec3 const & a, float b, float c) {
+        return Vec3( _mm_min_ps( _mm_max_ps( a.mSimd , _mm_set1_ps( b ) ) , _mm_set1_ps( c ) ) );
+    }
+    static Vec3 cross( Vec3 const & a , Vec3 const & b ) {
+       __m128 aYZX = _mm_shuffle_ps( a.mSimd , a.mSimd , _MM_SHUFFLE( 3 , 0 , 2 , 1 ) );
+       __m128 aZXY = _mm_shuffle_ps( a.mSimd , a.mSimd , _MM_SHUFFLE( 3 , 1 , 0 , 2 ) );
+       __m128 bYZX = _mm_shuffle_ps( b.mSimd , b.mSimd , _MM_SHUFFLE( 3 , 0 , 2 , 1 ) );
+       __m128 bZXY = _mm_shuffle_ps( b.mSimd , b.mSimd , _MM_SHUFFLE( 3 , 1 , 0 , 2 ) );
+       return Vec3( _mm_sub_ps( _mm_mul_ps( aYZX , bZXY ) , _mm_mul_ps( aZXY , bYZX ) ) );
+    }
+    void operator += (Vec3 const & other) { mSimd = _mm_add_ps( mSimd , other.mSimd ); }
+    void operator -= (Vec3 const & other) { mSimd = _mm_sub_ps( mSimd , other.mSimd ); }
+    void operator *= (float s) { mSimd = _mm_mul_ps( mSimd , _mm_set1_ps( s ) ); }
+    void operator /= (float s) { mSimd = _mm_div_ps( mSimd , _mm_set1_ps( s ) ); }
+    static Vec3 compProduct(Vec3 const & a , Vec3 const & b) { return Vec3( _mm_mul_ps( a.mSimd , b.mSimd ) ); }
+#else
+    void normalize() { float invL = 1.f / length(); mVals[0] *= invL; mVals[1] *= invL; mVals[2] *= invL; }
     static float dot( Vec3 const & a , Vec3 const & b ) {
        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
     }
@@ -71,6 +119,7 @@ public:
     static Vec3 compProduct(Vec3 const & a , Vec3 const & b) {
         return Vec3(a[0]*b[0] , a[1]*b[1] , a[2]*b[2]);
     }
+#endif
 
     unsigned int getMaxAbsoluteComponent() const {
         if( fabs(mVals[0]) > fabs(mVals[1]) ) {
@@ -94,6 +143,26 @@ public:
     }
 };
 
+#ifdef VEC3_USE_SSE
+static inline Vec3 operator + (Vec3 const & a , Vec3 const & b) {
+   return Vec3( _mm_add_ps( a.simd() , b.simd() ) );
+}
+static inline Vec3 operator - (Vec3 const & a , Vec3 const & b) {
+   return Vec3( _mm_sub_ps( a.simd() , b.simd() ) );
+}
+static inline Vec3 operator * (float a , Vec3 const & b) {
+   return Vec3( _mm_mul_ps( _mm_set1_ps( a ) , b.simd() ) );
+}
+static inline Vec3 operator * (Vec3 const & b , float a ) {
+   return Vec3( _mm_mul_ps( _mm_set1_ps( a ) , b.simd() ) );
+}
+static inline Vec3 operator * (Vec3 const & a, Vec3 const & b) {
+    return Vec3( _mm_mul_ps( a.simd() , b.simd() ) );
+}
+static inline Vec3 operator / (Vec3 const &  a , float b) {
+   return Vec3( _mm_div_ps( a.simd() , _mm_set1_ps( b ) ) );
+}
+#else
 static inline Vec3 operator + (Vec3 const & a , Vec3 const & b) {
    return Vec3(a[0]+b[0] , a[1]+b[1] , a[2]+b[2]);
 }
@@ -112,6 +181,7 @@ static inline Vec3 operator * (Vec3 const & a, Vec3 const & b) {
 static inline Vec3 operator / (Vec3 const &  a , float b) {
    return Vec3(a[0]/b , a[1]/b , a[2]/b);
 }
+#endif
 static inline std::ostream & operator << (std::ostream & s , Vec3 const & p) {
     s << p[0] << " " << p[1] << " " << p[2];
     return s;
@@ -156,13 +226,41 @@ public:
 
     // Multiplication de matrice avec un Vec3 : m.p
     //--> application d'un matrice de rotation à un point ou un vecteur
-    Vec3 operator*(const Vec3 &p) {
-        //Pour acceder a un element de la matrice (*this)(i,j) et du point p[i]
-        Vec3 res = Vec3(
-                    (*this)(0, 0) * p[0] + (*this)(0, 1) * p[1] + (*this)(0, 2) * p[2],
-                (*this)(1, 0) * p[0] + (*this)(1, 1) * p[1] + (*this)(1, 2) * p[2],
-                (*this)(2, 0) * p[0] + (*this)(2, 1) * p[1] + (*this)(2, 2) * p[2]);
-        return res;
+    Vec3 operator*(const Vec3 &p) const {
+#ifdef VEC3_USE_SSE
+        // combinaison des colonnes : meme ordre des operations que le produit ligne par ligne
+        __m128 c0 = _mm_setr_ps(vals[0], vals[3], vals[6], 0.f);
+        __m128 c1 = _mm_setr_ps(vals[1], vals[4], vals[7], 0.f);
+        __m128 c2 = _mm_setr_ps(vals[2], vals[5], vals[8], 0.f);
+        return Vec3(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))), _mm_mul_ps(c2, _mm_set1_ps(p[2]))));
+#else
+        return Vec3(vals[0] * p[0] + vals[1] * p[1] + vals[2] * p[2],
+                    vals[3] * p[0] + vals[4] * p[1] + vals[5] * p[2],
+                    vals[6] * p[0] + vals[7] * p[1] + vals[8] * p[2]);
+#endif
+    }
+
+    // Applique x -> m.x + t a n points ranges tous les stride octets (les positions d'un tableau de sommets) :
+    // meme resultat que (*this) * x + t, mais les colonnes ne sont chargees qu'une fois
+    void transformPoints(Vec3 *points, size_t n, size_t stride, const Vec3 &t) const {
+        char *p = (char *)points;
+#ifdef VEC3_USE_SSE
+        __m128 c0 = _mm_setr_ps(vals[0], vals[3], vals[6], 0.f);
+        __m128 c1 = _mm_setr_ps(vals[1], vals[4], vals[7], 0.f);
+        __m128 c2 = _mm_setr_ps(vals[2], vals[5], vals[8], 0.f);
+        for (size_t i = 0; i < n; ++i, p += stride) {
+            Vec3 &x = *(Vec3 *)p;
+            __m128 v = x.simd();
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(v, v, 0x00)), _mm_mul_ps(c1, _mm_shuffle_ps(v, v, 0x55))),
+                                  _mm_mul_ps(c2, _mm_shuffle_ps(v, v, 0xaa)));
+            x = Vec3(_mm_add_ps(r, t.simd()));
+        }
+#else
+        for (size_t i = 0; i < n; ++i, p += stride) {
+            Vec3 &x = *(Vec3 *)p;
+            x = (*this) * x + t;
+        }
+#endif
     }
 
     Mat3 operator*(const Mat3 &m2) { // calcul du produit matriciel m1.m2
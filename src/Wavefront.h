@@ -0,0 +1,227 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+#include "Vec3.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "Sampler.h"
+#include "Scene.h"
+#include "RayBinning.h"
+
+// -------------------------------------------
+// Wavefront path tracing.
+// Instead of following one path from the camera to its end, the tracer keeps a queue of paths and runs each stage
+// over the whole queue before the next one :
+//  - extension : closest hit of every ray as SIMD packets. Primary rays share the camera origin; secondary rays are
+//    first binned by origin and direction (see RayBinner) and the packets are made of rays of the same bins, or of
+//    consecutive rays when the queue is coherent already;
+//  - shading : hits sorted by material, diffuse vertices sample the lights and queue their shading, every path scatters;
+//  - shadows : shadow rays of the queued diffuse vertices, as one packet per light sample and per RAY_PACKET_SIZE vertices;
+//  - compaction : terminated paths leave the queue.
+// Every path keeps its own sampler and its contributions are summed in the same order as Scene::tracePath :
+// the colors are bitwise the same as the ones of Scene::rayTrace / Scene::rayTracePacket.
+// -------------------------------------------
+
+class WavefrontTracer {
+public:
+    void clear() {
+        m_rays.clear();
+        m_throughputs.clear();
+        m_samplers.clear();
+        m_slots.clear();
+        m_ambient.clear();
+        m_cones.clear();
+    }
+
+    // Queues a camera path, sampler being ready for its first scattering sample. Returns the slot of its color.
+    unsigned int addCameraPath( Ray const & ray , PixelSampler const & sampler , RayCone const & cone ) {
+        m_slots.push_back( (unsigned int)m_rays.size() );
+        m_rays.push_back( ray );
+        m_throughputs.push_back( Vec3( 1.f , 1.f , 1.f ) );
+        m_samplers.push_back( sampler );
+        m_ambient.push_back( 1 );
+        m_cones.push_back( cone );
+        return m_slots.back();
+    }
+
+    unsigned int size() const { return (unsigned int)m_rays.size(); }
+
+    // Traces every queued path; the queue is empty afterwards.
+    // With packets, the camera rays of the queue must all leave the same origin.
+    // With binning, secondary rays are reordered before their extension.
+    void trace( Scene const & scene , unsigned int maxDepth , bool packets , bool binning ) {
+        m_colors.assign( m_rays.size() , Vec3( 0.f , 0.f , 0.f ) );
+        for( unsigned int depth = 0 ; depth < maxDepth && !m_rays.empty() ; ++depth ) {
+            if( depth == 0 ) extend( scene , packets , NULL );
+            else if( packets && binning ) {
+                // rays that are coherent already are not sorted, but still traced as packets, in queue order
+                if( !m_binner.sort( m_rays , scene.bounds() , m_binOrder ) ) {
+                    m_binOrder.resize( m_rays.size() );
+                    std::iota( m_binOrder.begin() , m_binOrder.end() , 0u );
+                }
+                extend( scene , true , &m_binOrder[0] );
+            }
+            else extend( scene , false , NULL );
+            sortByMaterial( scene );
+            shade( scene , depth );
+            traceShadows( scene , packets );
+            compact();
+        }
+        clear();
+    }
+
+    Vec3 const & color( unsigned int slot ) const { return m_colors[slot]; }
+
+    RayBinningStatistics const & binningStatistics() const { return m_binner.statistics; }
+
+private:
+    // Packets are made of consecutive rays of order (of the queue if order is NULL). Without an order, the rays are
+    // taken as primary rays : the bounding cone of the packet around their origin culls the spheres.
+    void extend( Scene const & scene , bool packets , unsigned int const * order ) {
+        unsigned int n = size();
+        m_hits.resize( n );
+        if( !packets ) {
+            for( unsigned int i = 0 ; i < n ; ++i )
+                m_hits[i] = scene.computeIntersection( m_rays[i] );
+            return;
+        }
+        Ray rays[RAY_PACKET_SIZE];
+        unsigned int paths[RAY_PACKET_SIZE];
+        for( unsigned int first = 0 ; first < n ; first += RAY_PACKET_SIZE ) {
+            unsigned int count = std::min( n - first , RAY_PACKET_SIZE );
+            for( unsigned int i = 0 ; i < count ; ++i ) {
+                paths[i] = order ? order[first + i] : first + i;
+                rays[i] = m_rays[paths[i]];
+            }
+            RayPacket packet;
+            packet.set( rays , count );
+            if( order == NULL ) packet.computeCone( rays[0].origin() , 1.f );
+            scene.intersectPacket( packet );
+            for( unsigned int i = 0 ; i < count ; ++i )
+                m_hits[paths[i]] = scene.packetIntersection( packet , i , rays[i] );
+        }
+    }
+
+    // Counting sort of the paths that hit something by material type : each shading branch then runs over a contiguous run.
+    // Paths that missed are dropped from the order and end at compaction.
+    void sortByMaterial( Scene const & scene ) {
+        unsigned int n = size();
+        m_surfaces.resize( n );
+        m_materials.resize( n );
+        m_alive.assign( n , 0 );
+        unsigned int counts[MATERIAL_TYPES + 1] = { 0 };
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            if( !m_hits[i].intersectionExists ) continue;
+            m_surfaces[i] = scene.surfacePoint( m_rays[i] , m_hits[i] , m_cones[i] );
+            m_materials[i] = m_surfaces[i].material->type;
+            ++counts[m_materials[i] + 1];
+        }
+        for( unsigned int m = 1 ; m <= MATERIAL_TYPES ; ++m ) counts[m] += counts[m - 1];
+        m_order.resize( counts[MATERIAL_TYPES] );
+        for( unsigned int i = 0 ; i < n ; ++i )
+            if( m_hits[i].intersectionExists ) m_order[counts[m_materials[i]]++] = i;
+    }
+
+    void shade( Scene const & scene , unsigned int depth ) {
+        m_shadeRays.clear();
+        m_shadePaths.clear();
+        m_shadeWeights.clear();
+        m_shadeAmbient.clear();
+        unsigned int lightSamples = scene.lightSampleCount();
+        m_lightSamples.resize( m_order.size() * lightSamples );
+        for( unsigned int k = 0 ; k < m_order.size() ; ++k ) {
+            unsigned int i = m_order[k];
+            if( m_materials[i] == Material_Diffuse_Blinn_Phong ) {
+                scene.sampleLights( m_surfaces[i] , m_samplers[i] , m_lightSamples.data() + m_shadePaths.size() * lightSamples );
+                m_shadeRays.push_back( m_rays[i] );
+                m_shadePaths.push_back( i );
+                m_shadeWeights.push_back( m_throughputs[i] );
+                m_shadeAmbient.push_back( m_ambient[i] );
+                m_ambient[i] = 0;
+            }
+            m_alive[i] = scene.scatter( m_rays[i] , m_surfaces[i] , depth , m_samplers[i] , m_throughputs[i] , m_cones[i] );
+        }
+    }
+
+    void traceShadows( Scene const & scene , bool packets ) {
+        unsigned int n = (unsigned int)m_shadePaths.size();
+        unsigned int lightSamples = scene.lightSampleCount();
+        m_visible.resize( n * lightSamples );
+        if( packets ) {
+            SurfacePoint const * surfaces[RAY_PACKET_SIZE];
+            for( unsigned int first = 0 ; first < n ; first += RAY_PACKET_SIZE ) {
+                unsigned int count = std::min( n - first , RAY_PACKET_SIZE );
+                for( unsigned int i = 0 ; i < count ; ++i ) surfaces[i] = &m_surfaces[m_shadePaths[first + i]];
+                scene.visibleLightSamplesPacket( surfaces , m_lightSamples.data() + first * lightSamples , count , m_visible.data() + first * lightSamples );
+            }
+        } else {
+            for( unsigned int i = 0 ; i < n ; ++i )
+                scene.visibleLightSamples( m_surfaces[m_shadePaths[i]] , m_lightSamples.data() + i * lightSamples , m_visible.data() + i * lightSamples );
+        }
+        for( unsigned int i = 0 ; i < n ; ++i ) {
+            unsigned int path = m_shadePaths[i];
+            m_colors[m_slots[path]] += m_shadeWeights[i] * scene.shade( m_shadeRays[i] , m_surfaces[path] , m_lightSamples.data() + i * lightSamples ,
+                                                                        m_visible.data() + i * lightSamples , m_shadeAmbient[i] != 0 );
+        }
+    }
+
+    // Stable : the paths keep their order, and primary rays of one pixel stay together
+    void compact() {
+        unsigned int kept = 0;
+        for( unsigned int i = 0 ; i < size() ; ++i ) {
+            if( !m_alive[i] ) continue;
+            if( kept != i ) {
+                m_rays[kept] = m_rays[i];
+                m_throughputs[kept] = m_throughputs[i];
+                m_samplers[kept] = m_samplers[i];
+                m_slots[kept] = m_slots[i];
+                m_ambient[kept] = m_ambient[i];
+                m_cones[kept] = m_cones[i];
+            }
+            ++kept;
+        }
+        m_rays.erase( m_rays.begin() + kept , m_rays.end() );
+        m_throughputs.erase( m_throughputs.begin() + kept , m_throughputs.end() );
+        m_samplers.erase( m_samplers.begin() + kept , m_samplers.end() );
+        m_slots.erase( m_slots.begin() + kept , m_slots.end() );
+        m_ambient.erase( m_ambient.begin() + kept , m_ambient.end() );
+        m_cones.erase( m_cones.begin() + kept , m_cones.end() );
+    }
+
+    static const unsigned int MATERIAL_TYPES = 3;
+
+    // path queue, one array per field
+    std::vector< Ray > m_rays;
+    std::vector< Vec3 > m_throughputs;
+    std::vector< PixelSampler > m_samplers;
+    std::vector< unsigned int > m_slots;
+    std::vector< unsigned char > m_ambient;
+    std::vector< RayCone > m_cones;
+
+    // per path data of the current bounce
+    std::vector< RaySceneIntersection > m_hits;
+    std::vector< SurfacePoint > m_surfaces;
+    std::vector< unsigned int > m_materials;
+    std::vector< unsigned char > m_alive;
+    std::vector< unsigned int > m_order;
+
+    // diffuse vertices of the current bounce, waiting for their shadow rays : path, incoming ray and throughput before scattering
+    std::vector< unsigned int > m_shadePaths;
+    std::vector< Ray > m_shadeRays;
+    std::vector< Vec3 > m_shadeWeights;
+    std::vector< unsigned char > m_shadeAmbient;
+    // lightSampleCount() light samples per queued vertex, and whether they are visible from it
+    std::vector< LightSample > m_lightSamples;
+    std::vector< unsigned char > m_visible;
+
+    std::vector< Vec3 > m_colors;
+
+    RayBinner m_binner;
+    std::vector< unsigned int > m_binOrder;
+};
+
+#endif // WAVEFRONT_H
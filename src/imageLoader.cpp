@@ -1,5 +1,8 @@
-
 #include "imageLoader.h"
+#include "FileChunks.h"
+
+#include <algorithm>
+#include <sys/mman.h>
 
 // Source courtesy of J. Manson
 // http://josiahmanson.com/prose/optimize_ppm/
@@ -7,201 +10,248 @@
 
 namespace ppmLoader{
 using namespace std;
-void eat_comment(ifstream &f)
+
+ImageRGB::ImageRGB() : w(0), h(0), mapping(NULL), mappingSize(0), view(NULL) {}
+
+ImageRGB::~ImageRGB()
 {
-    char linebuf[1024];
-    char ppp;
-    while (ppp = f.peek(), ppp == '\n' || ppp == '\r')
-        f.get();
-    if (ppp == '#')
-        f.getline(linebuf, 1023);
+    clear();
 }
 
+ImageRGB::ImageRGB(ImageRGB && other) : w(0), h(0), mapping(NULL), mappingSize(0), view(NULL)
+{
+    *this = std::move(other);
+}
+
+ImageRGB & ImageRGB::operator=(ImageRGB && other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    w = other.w;
+    h = other.h;
+    data.swap(other.data);
+    mapping = other.mapping;
+    mappingSize = other.mappingSize;
+    view = other.view;
+    other.w = other.h = 0;
+    other.mapping = NULL;
+    other.mappingSize = 0;
+    other.view = NULL;
+    return *this;
+}
 
-void load_ppm(ImageRGB &img, const string &name)
+RGB * ImageRGB::mutablePixels()
 {
-    ifstream f(name.c_str(), ios::binary);
-    if (f.fail())
+    if (mapping != NULL)
     {
-        cout << "Could not open file: " << name << endl;
-        return;
+        data.assign(view, view + (size_t)w * h);
+        munmap(mapping, mappingSize);
+        mapping = NULL;
+        mappingSize = 0;
+        view = data.data();
     }
+    return data.data();
+}
 
-    // get type of file
-    eat_comment(f);
-    int mode = 0;
-    string s;
-    f >> s;
-    if (s == "P3")
-        mode = 3;
-    else if (s == "P6")
-        mode = 6;
-
-    // get w
-    eat_comment(f);
-    f >> img.w;
+void ImageRGB::clear()
+{
+    if (mapping != NULL)
+        munmap(mapping, mappingSize);
+    mapping = NULL;
+    mappingSize = 0;
+    view = NULL;
+    data.clear();
+    w = h = 0;
+}
 
-    // get h
-    eat_comment(f);
-    f >> img.h;
 
-    // get bits
-    eat_comment(f);
-    int bits = 0;
-    f >> bits;
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
 
-    // error checking
-    if (mode != 3 && mode != 6)
-    {
-        cout << "Unsupported magic number" << endl;
-        f.close();
-        return;
-    }
-    if (img.w < 1)
-    {
-        cout << "Unsupported width: " << img.w << endl;
-        f.close();
-        return;
-    }
-    if (img.h < 1)
-    {
-        cout << "Unsupported height: " << img.h << endl;
-        f.close();
-        return;
-    }
-    if (bits < 1 || bits > 255)
+// skips white space and comments of the header
+static const char * eat_comment(const char * p, const char * end)
+{
+    while (p < end)
     {
-        cout << "Unsupported number of bits: " << bits << endl;
-        f.close();
-        return;
+        if (*p == '#')
+            while (p < end && *p != '\n')
+                p++;
+        else if (is_space(*p))
+            p++;
+        else
+            break;
     }
+    return p;
+}
 
-    // load image data
-    img.data.resize(img.w * img.h);
+// decimal number of the header, NULL if there is none
+static const char * read_number(const char * p, const char * end, int & value)
+{
+    p = eat_comment(p, end);
+    const char * start = p;
+    long long v = 0;
+    while (p < end && (unsigned char)(*p - '0') < 10 && v <= 1 << 30)
+        v = 10 * v + (*p++ - '0');
+    if (p == start)
+        return NULL;
+    value = (int)v;
+    return p;
+}
 
-    if (mode == 6)
-    {
-        f.get();
-        f.read((char*)&img.data[0], img.data.size() * 3);
-    }
-    else if (mode == 3)
+// Samples of an ASCII raster in [p, end), at most maxCount : runs of digits, separated by anything else
+// (a '#' comment runs to the end of its line). Returns the number of samples read.
+static size_t parse_samples(const char * p, const char * end, unsigned char * out, size_t maxCount)
+{
+    size_t n = 0;
+    while (p < end && n < maxCount)
     {
-        for (unsigned int i = 0; i < img.data.size(); i++)
+        unsigned int digit = (unsigned char)(*p - '0');
+        if (digit >= 10)
         {
-            int v;
-            f >> v;
-            img.data[i].r = v;
-            f >> v;
-            img.data[i].g = v;
-            f >> v;
-            img.data[i].b = v;
+            if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                p++;
+            continue;
         }
+        unsigned int v = 0;
+        do
+        {
+            v = 10 * v + digit;
+            ++p;
+            digit = p < end ? (unsigned char)(*p - '0') : 10;
+        } while (digit < 10);
+        out[n++] = (unsigned char)v;
     }
+    return n;
+}
+
+// ASCII raster of count samples. Large rasters are cut into chunks at line ends, parsed on the loader pool, each
+// into its own buffer : a sample takes at least two bytes with its separator.
+static bool parse_ascii(const char * p, const char * end, unsigned char * out, size_t count)
+{
+    vector<const char *> bounds = split_at_lines(p, end);
+    unsigned int chunks = bounds.size() - 1;
+    if (chunks == 1)
+        return parse_samples(p, end, out, count) == count;
 
-    // close file
-    f.close();
+    vector< vector<unsigned char> > samples(chunks);
+    vector<size_t> counts(chunks, 0);
+    for_each_chunk(chunks, [&](unsigned int c) {
+        size_t capacity = min(count, (size_t)(bounds[c + 1] - bounds[c]) / 2 + 1);
+        samples[c].resize(capacity);
+        counts[c] = parse_samples(bounds[c], bounds[c + 1], samples[c].data(), capacity);
+    });
+
+    size_t n = 0;
+    for (unsigned int c = 0; c < chunks && n < count; c++)
+    {
+        size_t k = min(counts[c], count - n);
+        copy(samples[c].begin(), samples[c].begin() + k, out + n);
+        n += k;
+    }
+    return n == count;
 }
 
 
-void load_ppm( unsigned char * & pixels , unsigned int & w , unsigned int & h , const string &name , loadedFormat format)
+bool load_ppm(ImageRGB &img, const string &name, loadedFormat format)
 {
-    ifstream f(name.c_str(), ios::binary);
-    if (f.fail())
+    img.clear();
+    FileBytes file;
+    if (!file.open(name))
     {
         cout << "Could not open file: " << name << endl;
-        return;
+        return false;
     }
+    const char * p = file.begin();
+    const char * end = file.end();
 
     // get type of file
-    eat_comment(f);
+    p = eat_comment(p, end);
     int mode = 0;
-    string s;
-    f >> s;
-    if (s == "P3")
+    if (end - p >= 2 && p[0] == 'P' && p[1] == '3')
         mode = 3;
-    else if (s == "P6")
+    else if (end - p >= 2 && p[0] == 'P' && p[1] == '6')
         mode = 6;
 
-    // get w
-    eat_comment(f);
-    f >> w;
-
-    // get h
-    eat_comment(f);
-    f >> h;
-
-    // get bits
-    eat_comment(f);
-    int bits = 0;
-    f >> bits;
-
     // error checking
     if (mode != 3 && mode != 6)
     {
         cout << "Unsupported magic number" << endl;
-        f.close();
-        return;
+        return false;
+    }
+    p += 2;
+
+    // get w, h and bits
+    int w = 0, h = 0, bits = 0;
+    if ((p = read_number(p, end, w)) == NULL || (p = read_number(p, end, h)) == NULL || (p = read_number(p, end, bits)) == NULL)
+    {
+        cout << "Truncated header: " << name << endl;
+        return false;
     }
     if (w < 1)
     {
         cout << "Unsupported width: " << w << endl;
-        f.close();
-        return;
+        return false;
     }
     if (h < 1)
     {
         cout << "Unsupported height: " << h << endl;
-        f.close();
-        return;
+        return false;
     }
     if (bits < 1 || bits > 255)
     {
         cout << "Unsupported number of bits: " << bits << endl;
-        f.close();
-        return;
+        return false;
     }
 
     // load image data
-    pixels = new unsigned char[3 * w * h];
-
+    size_t samples = 3 * (size_t)w * h;
     if (mode == 6)
     {
-        f.get();
-        f.read( (char*)&(pixels[0]) , 3 * w * h );
+        // a single white space ends the header
+        if (p >= end || (size_t)(end - p - 1) < samples)
+        {
+            cout << "Truncated file: " << name << endl;
+            return false;
+        }
+        p++;
+        if (file.mapped())
+        {
+            img.mappingSize = file.size();
+            img.mapping = file.release();
+        }
+        else
+        {
+            img.data.assign((const RGB *)p, (const RGB *)p + (size_t)w * h);
+            p = (const char *)img.data.data();
+        }
+        img.view = (const RGB *)p;
     }
-    else if (mode == 3)
+    else
     {
-        for (unsigned int i = 0; i < w * h; i++)
+        img.data.resize((size_t)w * h);
+        if (!parse_ascii(p, end, (unsigned char *)img.data.data(), samples))
         {
-            int v;
-            f >> v;
-            pixels[3*i + 0] = v;
-            f >> v;
-            pixels[3*i + 1] = v;
-            f >> v;
-            pixels[3*i + 2] = v;
+            cout << "Truncated file: " << name << endl;
+            img.data.clear();
+            return false;
         }
+        img.view = img.data.data();
     }
+    img.w = w;
+    img.h = h;
 
-    // close file
-    f.close();
-
-    if(format == rgb) {
-        return;
-    }
-
-    if(format == rbg) {
-        for (unsigned int i = 0; i < w * h; i++)
-        {
-            unsigned char r = pixels[3*i + 0] , g = pixels[3*i + 1] , b = pixels[3*i + 2];
-            pixels[3*i + 0] = r;
-            pixels[3*i + 1] = b;
-            pixels[3*i + 2] = g;
-        }
-        return;
+    if (format == rbg)
+    {
+        RGB * pixels = img.mutablePixels();
+        for (size_t i = 0; i < (size_t)w * h; i++)
+            swap(pixels[i].g, pixels[i].b);
     }
+    return true;
 }
 }
-
-
-
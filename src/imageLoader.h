@@ -4,7 +4,7 @@
 #include <string>
 #include <vector>
 #include <iostream>
-#include <fstream>
+#include <cstddef>
 
 // Source courtesy of J. Manson
 // http://josiahmanson.com/prose/optimize_ppm/
@@ -12,30 +12,56 @@
 
 namespace ppmLoader{
 using namespace std;
-void eat_comment(ifstream &f);
 
 struct RGB
 {
     unsigned char r, g, b;
 };
+static_assert(sizeof(RGB) == 3, "RGB pixels are read as packed bytes");
 
-struct ImageRGB
+
+enum loadedFormat {
+    rgb,
+    rbg
+};
+
+
+// An image, w * h pixels row by row.
+// The pixels of a binary (P6) file are a read only view in the memory mapped file, unmapped with the image : loading
+// copies nothing. Other pixels (ASCII files, converted channels) are owned by the image.
+// Images can be moved but not copied.
+class ImageRGB
 {
+public:
     int w, h;
-    vector<RGB> data;
-};
 
+    ImageRGB();
+    ~ImageRGB();
+    ImageRGB(ImageRGB && other);
+    ImageRGB & operator=(ImageRGB && other);
 
-void load_ppm(ImageRGB &img, const string &name);
+    bool empty() const { return view == NULL; }
+    RGB const * pixels() const { return view; }
+    // The pixels, copied first if they are a view in the file
+    RGB * mutablePixels();
+    void clear();
 
+    ImageRGB(ImageRGB const &) = delete;
+    ImageRGB & operator=(ImageRGB const &) = delete;
 
-enum loadedFormat {
-    rgb,
-    rbg
+private:
+    friend bool load_ppm(ImageRGB &img, const string &name, loadedFormat format);
+
+    vector<RGB> data;
+    void * mapping;
+    size_t mappingSize;
+    RGB const * view;
 };
 
 
-void load_ppm( unsigned char * & pixels , unsigned int & w , unsigned int & h , const string &name , loadedFormat format = rgb);
+// Loads a P6 or P3 file, with channels reordered as format. Returns false, with an empty image, if the file could not be read.
+// ASCII rasters are parsed on the loader pool (see FileChunks.h) when they are large.
+bool load_ppm(ImageRGB &img, const string &name, loadedFormat format = rgb);
 }
 
 #endif
@@ -2,6 +2,7 @@
 #define matrixUtilities_H
 
 #include "Vec3.h"
+#include "Camera.h"
 
 template< class T >
 bool gluInvertMatrix(const T m[16], T invOut[16])
@@ -184,41 +185,68 @@ void mult( const T m[16] , T x[4] , T res[4] ) {
 
 
 
-// These functions are not optimized, because you probably don't want to invert the camera matrices every time!
-Vec3 cameraSpaceToWorldSpace(Vec3 const & pCS) { // pCS : p in Camera Space
+// Snapshot of the GL camera state. GL calls are only valid on the thread owning the context,
+// so the render threads work from a copy taken once per frame on the GLUT thread.
+struct CameraMatrices {
     GLdouble modelview[16];
+    GLdouble projection[16];
+    GLdouble depthRange[2];
+};
+
+void get_camera_matrices( CameraMatrices & matrices ) {
+    glGetDoublev( GL_MODELVIEW_MATRIX, matrices.modelview );
+    glGetDoublev( GL_PROJECTION_MATRIX, matrices.projection );
+    glGetDoublev( GL_DEPTH_RANGE , matrices.depthRange );
+}
+
+// Same snapshot, built from the camera state only : no GL context needed
+void get_camera_matrices( Camera const & camera , CameraMatrices & matrices ) {
+    camera.getModelViewMatrix( matrices.modelview );
+    camera.getProjectionMatrix( matrices.projection );
+    matrices.depthRange[0] = 0.0; // glDepthRange defaults
+    matrices.depthRange[1] = 1.0;
+}
+
+// These functions are not optimized, because you probably don't want to invert the camera matrices every time!
+Vec3 cameraSpaceToWorldSpace(Vec3 const & pCS , CameraMatrices const & matrices) { // pCS : p in Camera Space
     GLdouble modelviewInverse[16];
-    glMatrixMode (GL_MODELVIEW);
-    glGetDoublev( GL_MODELVIEW_MATRIX, modelview );
-    gluInvertMatrix( modelview , modelviewInverse );
+    gluInvertMatrix( matrices.modelview , modelviewInverse );
     GLdouble res[4];
     mult(modelviewInverse , (GLdouble)pCS[0] , (GLdouble)pCS[1] , (GLdouble)pCS[2] , (GLdouble)1.0 , res[0] , res[1] , res[2] , res[3]);
     return Vec3( res[0] / res[3] , res[1] / res[3] , res[2] / res[3] );
 }
-Vec3 screen_space_to_worldSpace( float u , float v ) {
+Vec3 screen_space_to_worldSpace( float u , float v , CameraMatrices const & matrices ) {
     // u et v sont entre 0 et 1 (0,0 est en haut a gauche de l'ecran)
-    GLdouble projection[16];
     GLdouble projectionInverse[16];
-    glMatrixMode (GL_PROJECTION);
-    glGetDoublev( GL_PROJECTION_MATRIX, projection );
-    gluInvertMatrix( projection , projectionInverse );
-    GLdouble nearAndFarPlanes[2];
-    glGetDoublev( GL_DEPTH_RANGE , nearAndFarPlanes );
-    GLdouble modelview[16];
+    gluInvertMatrix( matrices.projection , projectionInverse );
     GLdouble modelviewInverse[16];
-    glMatrixMode (GL_MODELVIEW);
-    glGetDoublev( GL_MODELVIEW_MATRIX, modelview );
-    gluInvertMatrix( modelview , modelviewInverse );
+    gluInvertMatrix( matrices.modelview , modelviewInverse );
     GLdouble resInt[4];
-    mult(projectionInverse , (GLdouble)2.f*u - 1.f , -((GLdouble)2.f*v - 1.f) , nearAndFarPlanes[0] , (GLdouble)1.0 , resInt[0] , resInt[1] , resInt[2] , resInt[3]);
+    mult(projectionInverse , (GLdouble)2.f*u - 1.f , -((GLdouble)2.f*v - 1.f) , matrices.depthRange[0] , (GLdouble)1.0 , resInt[0] , resInt[1] , resInt[2] , resInt[3]);
     GLdouble res[4];
     mult(modelviewInverse , resInt[0] , resInt[1] , resInt[2] , resInt[3] , res[0] , res[1] , res[2] , res[3]);
     return Vec3( res[0] / res[3] , res[1] / res[3] , res[2] / res[3] );
 }
-void screen_space_to_world_space_ray(float u , float v , Vec3 & position , Vec3 & direction) {
-    position = cameraSpaceToWorldSpace( Vec3(0,0,0) );
-    direction = screen_space_to_worldSpace(u,v) - position;
+void screen_space_to_world_space_ray(float u , float v , CameraMatrices const & matrices , Vec3 & position , Vec3 & direction) {
+    position = cameraSpaceToWorldSpace( Vec3(0,0,0) , matrices );
+    direction = screen_space_to_worldSpace(u,v,matrices) - position;
     direction.normalize();
 }
 
+Vec3 cameraSpaceToWorldSpace(Vec3 const & pCS) {
+    CameraMatrices matrices;
+    get_camera_matrices( matrices );
+    return cameraSpaceToWorldSpace( pCS , matrices );
+}
+Vec3 screen_space_to_worldSpace( float u , float v ) {
+    CameraMatrices matrices;
+    get_camera_matrices( matrices );
+    return screen_space_to_worldSpace( u , v , matrices );
+}
+void screen_space_to_world_space_ray(float u , float v , Vec3 & position , Vec3 & direction) {
+    CameraMatrices matrices;
+    get_camera_matrices( matrices );
+    screen_space_to_world_space_ray( u , v , matrices , position , direction );
+}
+
 #endif // matrixUtilities_H
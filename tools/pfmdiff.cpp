@@ -0,0 +1,57 @@
+// -------------------------------------------
+// pfmdiff : largest absolute difference between the channels of two PFM images of the same size.
+// Usage : pfmdiff a.pfm b.pfm [tolerance]
+// Exits with 1 when the images cannot be compared or differ by more than the tolerance (default 0).
+// -------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool read_pfm( std::string const & name , int & w , int & h , int & channels , std::vector< float > & values ) {
+    std::ifstream f( name.c_str() , std::ios::binary );
+    std::string magic;
+    float scale = 0.f;
+    if( !( f >> magic >> w >> h >> scale ) || ( magic != "PF" && magic != "Pf" ) || w < 1 || h < 1 || scale >= 0.f )
+        return false;
+    f.get(); // the single white space that ends the header
+    channels = magic == "PF" ? 3 : 1;
+    values.resize( (size_t)w * h * channels );
+    // negative scale : little endian, as written by ImageWriter on the machines this runs on
+    f.read( (char *)values.data() , values.size() * sizeof( float ) );
+    return (size_t)f.gcount() == values.size() * sizeof( float );
+}
+
+int main( int argc , char ** argv ) {
+    if( argc < 3 ) {
+        std::cerr << "Usage : " << argv[0] << " a.pfm b.pfm [tolerance]" << std::endl;
+        return 1;
+    }
+    float tolerance = argc > 3 ? (float)atof( argv[3] ) : 0.f;
+    int wa , ha , ca , wb , hb , cb;
+    std::vector< float > a , b;
+    if( !read_pfm( argv[1] , wa , ha , ca , a ) || !read_pfm( argv[2] , wb , hb , cb , b ) ) {
+        std::cerr << "Could not read " << argv[1] << " and " << argv[2] << " as PFM images" << std::endl;
+        return 1;
+    }
+    if( wa != wb || ha != hb || ca != cb ) {
+        std::cerr << argv[1] << " and " << argv[2] << " differ in size" << std::endl;
+        return 1;
+    }
+
+    float maxDifference = 0.f;
+    size_t differing = 0;
+    for( size_t i = 0 ; i < a.size() ; ++i ) {
+        float d = std::fabs( a[i] - b[i] );
+        // NaN on one side only is a difference too
+        if( d != d ) d = ( a[i] != a[i] ) == ( b[i] != b[i] ) ? 0.f : INFINITY;
+        if( d > maxDifference ) maxDifference = d;
+        if( d > tolerance ) ++differing;
+    }
+    printf( "%s / %s : max difference %g, %zu of %zu values above %g\n" , argv[1] , argv[2] , maxDifference , differing , a.size() , tolerance );
+    return maxDifference > tolerance ? 1 : 0;
+}